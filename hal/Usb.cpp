@@ -26,13 +26,13 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
 #include <assert.h>
 #include <chrono>
 #include <dirent.h>
-#include <regex>
 #include <stdio.h>
 #include <sys/eventfd.h>
 #include <sys/types.h>
@@ -47,11 +47,15 @@
 #include <utils/StrongPointer.h>
 
 #include "Usb.h"
+#include "UsbSysfs.h"
+#include "UsbUevent.h"
 
 #define VENDOR_USB_ADB_DISABLED_PROP "vendor.sys.usb.adb.disabled"
 #define USB_CONTROLLER_PROP "vendor.usb.controller"
 #define USB_MODE_PATH "/sys/bus/platform/devices/"
 #define USB_UDC_PATH "/sys/class/udc"
+#define GADGET_CONFIG_PATH "/config/usb_gadget/g1/configs/b.1/"
+#define GADGET_UDC_PATH "/config/usb_gadget/g1/UDC"
 
 namespace aidl {
 namespace android {
@@ -60,10 +64,20 @@ namespace usb {
 
 using ::android::base::SetProperty;
 using ::android::base::GetProperty;
+using ::android::base::StringAppendF;
 using ::android::base::Trim;
 using ::android::base::ReadFileToString;
 using ::android::base::WriteStringToFile;
 
+// Notifications that may be pending delivery to the framework
+constexpr size_t kCallbackQueueDepth = 64;
+
+// The moisture sensors are read through the charger, which serves this port
+constexpr char kContaminantPort[] = "port0";
+
+// Worker time the autosuspend scan takes before letting other work run
+constexpr std::chrono::microseconds kAutosuspendScanSlice(2000);
+
 const char GOOGLE_USB_VENDOR_ID_STR[] = "18d1";
 const char GOOGLE_USBC_35_ADAPTER_UNPLUGGED_ID_STR[] = "5029";
 
@@ -73,41 +87,14 @@ static void checkUsbDeviceAutoSuspend(const std::string& devicePath);
 static bool checkUsbInterfaceAutoSuspend(const std::string& devicePath,
         const std::string &intf);
 
-static void getUsbControllerPath(std::string &controllerPath) {
-  std::string controllerName = GetProperty(USB_CONTROLLER_PROP, "");
-  std::string dwcDriver = "/sys/bus/platform/drivers/msm-dwc3/";
-  struct dirent *deviceDir;
-  std::string entry = "";
-  std::size_t idx;
-  DIR *gd;
-
-  //Fetch controller address from vendor prop
-  idx = controllerName.find(".");
-  controllerName = controllerName.substr(0, idx);
-  gd = opendir(dwcDriver.c_str());
-  if (gd != NULL) {
-    //Search for soft link to device
-    while ((deviceDir = readdir(gd))) {
-      if (deviceDir->d_type == DT_LNK &&
-          strstr(deviceDir->d_name, controllerName.c_str())) {
-        entry = deviceDir->d_name;
-        controllerPath += dwcDriver + entry + "/";
-        break;
-      }
-    }
-    closedir(gd);
-  }
-}
-
 ScopedAStatus Usb::enableUsbData(const std::string& in_portName, bool in_enable,
     int64_t in_transactionId) {
-  std::scoped_lock lock(mLock);
   aidl::android::hardware::usb::Status status = Status::SUCCESS;
   std::string dwcDriver = "";
   int ret;
 
   ALOGI("enableUsbData in_enable: %d", in_enable);
-  getUsbControllerPath(dwcDriver);
+  dwcDriver = mControllers.primaryPath();
   if (dwcDriver == "") {
     ALOGE("resetUsbPort unable to find dwc device");
     status = Status::ERROR;
@@ -131,18 +118,15 @@ ScopedAStatus Usb::enableUsbData(const std::string& in_portName, bool in_enable,
   usbDataDisabled = !in_enable;
 
 out:
-  if (mCallback) {
-    std::vector<PortStatus> currentPortStatus;
-    ScopedAStatus ret = mCallback->notifyEnableUsbDataStatus(in_portName, in_enable,
-        status, in_transactionId);
-    if (!ret.isOk())
-      ALOGE("notifyEnableUsbDataStatus error %s", ret.getDescription().c_str());
-
-    status = getPortStatusHelper(currentPortStatus, mContaminantStatusPath);
-    ret = mCallback->notifyPortStatusChange(currentPortStatus,
-          status);
-    if (!ret.isOk())
-      ALOGE("queryPortStatus error %s", ret.getDescription().c_str());
+  std::shared_ptr<IUsbCallback> callback = currentCallback();
+  if (callback) {
+    mDispatcher.post(callback, "notifyEnableUsbDataStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyEnableUsbDataStatus(in_portName, in_enable, status,
+                                               in_transactionId);
+        });
+
+    queuePortStatus(callback);
   } else {
     ALOGE("Not notifying the userspace. Callback is not set");
   }
@@ -152,12 +136,14 @@ out:
 
 ScopedAStatus Usb::enableUsbDataWhileDocked(const std::string& in_portName,
     int64_t in_transactionId) {
-  std::scoped_lock lock(mLock);
-  if (mCallback) {
-    ScopedAStatus ret = mCallback->notifyEnableUsbDataWhileDockedStatus(
-        in_portName, Status::NOT_SUPPORTED, in_transactionId);
-    if (!ret.isOk())
-      ALOGE("notifyEnableUsbDataWhileDockedStatus error %s", ret.getDescription().c_str());
+  std::shared_ptr<IUsbCallback> callback = currentCallback();
+
+  if (callback) {
+    mDispatcher.post(callback, "notifyEnableUsbDataWhileDockedStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyEnableUsbDataWhileDockedStatus(in_portName, Status::NOT_SUPPORTED,
+                                                          in_transactionId);
+        });
   } else {
     ALOGE("Not notifying the userspace. Callback is not set");
   }
@@ -171,7 +157,7 @@ static std::string appendRoleNodeHelper(const std::string &portName, PortRole::T
        return "";
     }
 
-    std::string node("/sys/class/typec/" + portName);
+    std::string node(fsPath("/sys/class/typec/") + portName);
 
     switch (tag) {
       case PortRole::dataRole:
@@ -205,15 +191,16 @@ static const char *convertRoletoString(PortRole role) {
   return "none";
 }
 
-static void extractRole(std::string &roleName) {
+static std::string_view extractRole(std::string_view roleName) {
   std::size_t first, last;
 
   first = roleName.find("[");
   last = roleName.find("]");
 
-  if (first != std::string::npos && last != std::string::npos) {
+  if (first != std::string_view::npos && last != std::string_view::npos)
     roleName = roleName.substr(first + 1, last - first - 1);
-  }
+
+  return roleName;
 }
 
 static void switchToDrp(const std::string &portName) {
@@ -223,184 +210,290 @@ static void switchToDrp(const std::string &portName) {
     ALOGE("Fatal: Error while switching back to drp");
 }
 
-bool Usb::switchMode(const std::string &portName, const PortRole &newRole) {
-  std::string filename = appendRoleNodeHelper(portName, newRole.getTag());
-  bool roleSwitch = false;
+Usb::Usb() : mDispatcher(kCallbackQueueDepth), mContaminantDetected(0),
+    mContaminantCleared(0), mPortStateStale(true), mWorkerRunning(false) {
+  mTaskFd = unique_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+  if (mTaskFd == -1)
+    ALOGE("task eventfd failed; errno=%d", errno);
 
-  if (filename == "") {
-    ALOGE("Fatal: invalid node type");
+  mControllers.scan();
+}
+
+/*
+ * Run task on the uevent worker thread. Returns false if the worker is not
+ * running, in which case the task is dropped.
+ */
+bool Usb::runOnWorker(std::function<void()> task) {
+  std::scoped_lock lock(mTaskLock);
+
+  if (!mWorkerRunning)
     return false;
-  }
 
+  mTasks.push_back(std::move(task));
+  eventfd_write(mTaskFd, 1);
+  return true;
+}
+
+void Usb::runTasks() {
+  std::deque<std::function<void()>> tasks;
+  eventfd_t val;
+
+  eventfd_read(mTaskFd, &val);
   {
-    // Hold the lock here to prevent loosing connected signals
-    // as once the file is written the partner added signal
-    // can arrive anytime.
-    std::unique_lock lock(mPartnerLock);
-    mPartnerUp = false;
-    if (WriteStringToFile(convertRoletoString(newRole), filename)) {
-      // The type-c stack waits for 4.5 - 5.5 secs before declaring a port non-pd.
-      // The -partner directory would not be created until this is done.
-      // Having a margin of ~3 secs for the directory and other related bookeeping
-      // structures created and uvent fired.
-      constexpr std::chrono::seconds port_timeout(8);
-
-wait_again:
-      if (mPartnerCV.wait_for(lock, port_timeout) == std::cv_status::timeout) {
-        // There are no uevent signals which implies role swap timed out.
-        ALOGI("uevents wait timedout");
-      } else if (!mPartnerUp) { // Sanity check.
-        goto wait_again;
-      } else {
-        // Role switch succeeded since usb->mPartnerUp is true.
-        roleSwitch = true;
-      }
-    } else {
-      ALOGI("Role switch failed while writing to file");
-    }
+    std::scoped_lock lock(mTaskLock);
+    tasks.swap(mTasks);
   }
 
-  if (!roleSwitch)
-    switchToDrp(portName);
+  for (auto &task : tasks)
+    task();
+}
 
-  return roleSwitch;
+uint64_t Usb::runAfter(std::chrono::milliseconds delay, std::function<void()> task) {
+  return mTimerQueue.schedule(delay, std::move(task));
 }
 
-Usb::Usb() : mPartnerUp(false), mContaminantPresence(false) { }
+static const char *roleSwitchStateToString(RoleSwitchState state) {
+  switch (state) {
+    case RoleSwitchState::REQUESTED:
+      return "requested";
+    case RoleSwitchState::WRITTEN:
+      return "written";
+    case RoleSwitchState::AWAITING_PARTNER:
+      return "awaiting partner";
+    case RoleSwitchState::SETTLED:
+      return "settled";
+    case RoleSwitchState::REVERTED:
+      return "reverted to drp";
+    default:
+      return "unknown";
+  }
+}
 
-ScopedAStatus Usb::switchRole(const std::string &portName, const PortRole &newRole,
-    int64_t in_transactionId) {
-  std::string filename = appendRoleNodeHelper(portName, newRole.getTag());
+/*
+ * Role switch engine. Each port has a queue of switchRole() requests whose
+ * head is driven through REQUESTED -> WRITTEN -> [AWAITING_PARTNER] ->
+ * SETTLED or REVERTED by the uevent worker, from typec uevents and the
+ * partner timeout. Ports progress independently of each other and no
+ * binder thread ever waits for the partner.
+ *
+ * All of the functions below run on the uevent worker thread.
+ */
+void Usb::startRoleSwitch(const std::string &portName) {
+  RoleSwitchRequest &req = mRoleSwitches[portName].front();
+  std::string filename = appendRoleNodeHelper(portName, req.role.getTag());
+  const char *role = convertRoletoString(req.role);
   std::string written;
   bool roleSwitch = false;
 
-  if (filename == "") {
-    ALOGE("Fatal: invalid node type");
-    return ScopedAStatus::ok();
+  ALOGI("filename write: %s role:%s", filename.c_str(), role);
+
+  if (!WriteStringToFile(role, filename)) {
+    ALOGE("Role switch failed while writing to file");
+    finishRoleSwitch(portName, false);
+    return;
   }
 
-  std::scoped_lock role_lock(mRoleSwitchLock);
+  req.state = RoleSwitchState::WRITTEN;
 
-  ALOGI("filename write: %s role:%s", filename.c_str(), convertRoletoString(newRole));
+  if (req.role.getTag() == PortRole::mode) {
+    // The type-c stack waits for 4.5 - 5.5 secs before declaring a port non-pd.
+    // The -partner directory would not be created until this is done.
+    // Having a margin of ~3 secs for the directory and other related bookeeping
+    // structures created and uvent fired.
+    constexpr std::chrono::seconds port_timeout(8);
 
-  if (newRole.getTag() == PortRole::mode) {
-      roleSwitch = switchMode(portName, newRole);
-  } else {
-    if (WriteStringToFile(convertRoletoString(newRole), filename)) {
-      if (ReadFileToString(filename, &written)) {
-        extractRole(written);
-        ALOGI("written: %s", written.c_str());
-        if (written == convertRoletoString(newRole)) {
-          roleSwitch = true;
-        } else {
-          ALOGE("Role switch failed");
-        }
-      } else {
-        ALOGE("Unable to read back the new role");
-      }
+    req.state = RoleSwitchState::AWAITING_PARTNER;
+    req.timer = runAfter(port_timeout, [this, portName] { roleSwitchTimedOut(portName); });
+    return;
+  }
+
+  if (ReadFileToString(filename, &written)) {
+    written = std::string(extractRole(written));
+    ALOGI("written: %s", written.c_str());
+    if (written == role) {
+      roleSwitch = true;
     } else {
-      ALOGE("Role switch failed while writing to file");
+      ALOGE("Role switch failed");
     }
+  } else {
+    ALOGE("Unable to read back the new role");
   }
 
-  std::scoped_lock lock(mLock);
-  if (mCallback) {
-    ScopedAStatus ret = mCallback->notifyRoleSwitchStatus(portName, newRole,
-        roleSwitch ? Status::SUCCESS : Status::ERROR, in_transactionId);
-    if (!ret.isOk())
-      ALOGE("RoleSwitchStatus error %s", ret.getDescription().c_str());
+  finishRoleSwitch(portName, roleSwitch);
+}
+
+void Usb::notifyRoleSwitch(const std::string &portName, const RoleSwitchRequest &req,
+    Status status) {
+  if (req.callback) {
+    mDispatcher.post(req.callback, "notifyRoleSwitchStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyRoleSwitchStatus(portName, req.role, status, req.transactionId);
+        });
   } else {
     ALOGE("Not notifying the userspace. Callback is not set");
   }
+}
 
-  return ScopedAStatus::ok();
+void Usb::finishRoleSwitch(const std::string &portName, bool roleSwitch) {
+  auto it = mRoleSwitches.find(portName);
+  RoleSwitchRequest req = it->second.front();
+
+  it->second.pop_front();
+  if (req.timer)
+    mTimerQueue.cancel(req.timer);
+
+  // A port left in a forced mode without a partner would be unusable
+  if (!roleSwitch && req.role.getTag() == PortRole::mode) {
+    switchToDrp(portName);
+    req.state = RoleSwitchState::REVERTED;
+    mRoleSwitchStats.reverted++;
+  } else {
+    req.state = RoleSwitchState::SETTLED;
+    if (roleSwitch)
+      mRoleSwitchStats.succeeded++;
+    else
+      mRoleSwitchStats.failed++;
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - req.requested).count();
+  mRoleSwitchStats.durationMs.record(elapsed);
+
+  ALOGI("role switch %s on %s: %s after %lldms", convertRoletoString(req.role),
+        portName.c_str(), roleSwitchStateToString(req.state), (long long)elapsed);
+
+  notifyRoleSwitch(portName, req, roleSwitch ? Status::SUCCESS : Status::ERROR);
+
+  if (it->second.empty())
+    mRoleSwitches.erase(it);
+  else
+    startRoleSwitch(portName);
 }
 
-static Status getAccessoryConnected(const std::string &portName, std::string &accessory) {
-  std::string filename = "/sys/class/typec/" + portName + "-partner/accessory_mode";
+/*
+ * Fail every queued request when the worker stops, reverting a port left
+ * in a forced mode, so that no caller waits for an answer that never comes.
+ */
+void Usb::abortRoleSwitches() {
+  for (auto &[portName, queue] : mRoleSwitches) {
+    for (RoleSwitchRequest &req : queue) {
+      if (req.timer)
+        mTimerQueue.cancel(req.timer);
+
+      if (req.state != RoleSwitchState::REQUESTED && req.role.getTag() == PortRole::mode) {
+        switchToDrp(portName);
+        mRoleSwitchStats.reverted++;
+      } else {
+        mRoleSwitchStats.failed++;
+      }
 
-  if (!ReadFileToString(filename, &accessory)) {
-    ALOGE("getAccessoryConnected: Failed to open filesystem node: %s",
-          filename.c_str());
-    return Status::ERROR;
+      ALOGI("role switch %s on %s: aborted", convertRoletoString(req.role), portName.c_str());
+      notifyRoleSwitch(portName, req, Status::ERROR);
+    }
   }
 
-  accessory = Trim(accessory);
-  return Status::SUCCESS;
+  mRoleSwitches.clear();
 }
 
-static Status getCurrentRoleHelper(const std::string &portName, bool connected,
-                                   PortRole &currentRole) {
-  std::string filename;
-  std::string roleName;
-  std::string accessory;
+bool Usb::roleSwitchActive(const std::string &portName) {
+  return mRoleSwitches.count(portName) != 0;
+}
 
-  // Mode
+void Usb::roleSwitchPartnerAdded(const std::string &portName) {
+  auto it = mRoleSwitches.find(portName);
 
-  if (currentRole.getTag() == PortRole::powerRole) {
-    filename = "/sys/class/typec/" + portName + "/power_role";
-    currentRole.set<PortRole::powerRole>(PortPowerRole::NONE);
-  } else if (currentRole.getTag() == PortRole::dataRole) {
-    filename = "/sys/class/typec/" + portName + "/data_role";
-    currentRole.set<PortRole::dataRole>(PortDataRole::NONE);
-  } else if (currentRole.getTag() == PortRole::mode) {
-    filename = "/sys/class/typec/" + portName + "/data_role";
-    currentRole.set<PortRole::mode>(PortMode::NONE);
-  } else {
-    return Status::ERROR;
+  // Role switch succeeded since the partner came back online
+  if (it != mRoleSwitches.end() &&
+      it->second.front().state == RoleSwitchState::AWAITING_PARTNER)
+    finishRoleSwitch(portName, true);
+}
+
+void Usb::roleSwitchTimedOut(const std::string &portName) {
+  auto it = mRoleSwitches.find(portName);
+
+  if (it == mRoleSwitches.end() ||
+      it->second.front().state != RoleSwitchState::AWAITING_PARTNER)
+    return;
+
+  // There are no uevent signals which implies role swap timed out.
+  ALOGI("uevents wait timedout");
+  it->second.front().timer = 0;
+  finishRoleSwitch(portName, false);
+}
+
+ScopedAStatus Usb::switchRole(const std::string &portName, const PortRole &newRole,
+    int64_t in_transactionId) {
+  std::string filename = appendRoleNodeHelper(portName, newRole.getTag());
+
+  if (filename == "") {
+    ALOGE("Fatal: invalid node type");
+    return ScopedAStatus::ok();
   }
 
-  if (!connected)
-    return Status::SUCCESS;
+  RoleSwitchRequest req = { newRole, in_transactionId, RoleSwitchState::REQUESTED,
+                            std::chrono::steady_clock::now(), 0, currentCallback() };
 
-  if (currentRole.getTag() == PortRole::mode) {
-    if (getAccessoryConnected(portName, accessory) != Status::SUCCESS) {
-      return Status::ERROR;
-    }
-    if (accessory == "analog_audio") {
-      currentRole.set<PortRole::mode>(PortMode::AUDIO_ACCESSORY);
-      return Status::SUCCESS;
-    } else if (accessory == "debug") {
-      currentRole.set<PortRole::mode>(PortMode::DEBUG_ACCESSORY);
-      return Status::SUCCESS;
-    }
+  bool queued = runOnWorker([this, portName, req] {
+    auto &queue = mRoleSwitches[portName];
+
+    queue.push_back(req);
+    if (queue.size() == 1)
+      startRoleSwitch(portName);
+  });
+
+  // Only without a callback, or if the worker failed to start
+  if (!queued) {
+    ALOGE("Role switch on %s failed, uevent worker not running", portName.c_str());
+    mRoleSwitchStats.failed++;
+    notifyRoleSwitch(portName, req, Status::ERROR);
   }
 
-  if (!ReadFileToString(filename, &roleName)) {
-    ALOGE("getCurrentRole: Failed to open filesystem node: %s", filename.c_str());
+  return ScopedAStatus::ok();
+}
+
+TypecPortAttrs::TypecPortAttrs(const std::string &portName)
+    : powerRole(fsPath("/sys/class/typec/") + portName + "/power_role"),
+      dataRole(fsPath("/sys/class/typec/") + portName + "/data_role"),
+      accessoryMode(fsPath("/sys/class/typec/") + portName + "-partner/accessory_mode"),
+      supportsPd(fsPath("/sys/class/typec/") + portName +
+                 "-partner/supports_usb_power_delivery") {
+}
+
+TypecPortPower::TypecPortPower(const std::string &portName)
+    : opModeAttr(fsPath("/sys/class/typec/") + portName + "/power_operation_mode") {
+}
+
+static Status getAccessoryConnected(SysfsAttr &attr, std::string_view &accessory,
+                                    char *buf, size_t len) {
+  ssize_t n = attr.read(buf, len);
+
+  if (n < 0) {
+    ALOGE("getAccessoryConnected: Failed to open filesystem node: %s",
+          attr.path().c_str());
     return Status::ERROR;
   }
 
-  extractRole(roleName);
+  accessory = std::string_view(buf, n);
+  return Status::SUCCESS;
+}
 
-  if (roleName == "source") {
-    currentRole.set<PortRole::powerRole>(PortPowerRole::SOURCE);
-  } else if (roleName == "sink") {
-    currentRole.set<PortRole::powerRole>(PortPowerRole::SINK);
-  } else if (roleName == "host") {
-    if (currentRole.getTag() == PortRole::dataRole)
-      currentRole.set<PortRole::dataRole>(PortDataRole::HOST);
-    else
-      currentRole.set<PortRole::mode>(PortMode::DFP);
-  } else if (roleName == "device") {
-    if (currentRole.getTag() == PortRole::dataRole)
-      currentRole.set<PortRole::dataRole>(PortDataRole::DEVICE);
-    else
-      currentRole.set<PortRole::mode>(PortMode::UFP);
-  } else if (roleName != "none") {
-    /* case for none has already been addressed.
-     * so we check if the role isn't none.
-     */
-    return Status::UNRECOGNIZED_ROLE;
+static Status readRoleHelper(SysfsAttr &attr, std::string_view &roleName,
+                             char *buf, size_t len) {
+  ssize_t n = attr.read(buf, len);
+
+  if (n < 0) {
+    ALOGE("getCurrentRole: Failed to open filesystem node: %s", attr.path().c_str());
+    return Status::ERROR;
   }
 
+  roleName = extractRole(std::string_view(buf, n));
   return Status::SUCCESS;
 }
 
 static std::unordered_map<std::string, bool> getTypeCPortNamesHelper() {
   std::unordered_map<std::string, bool> names;
   DIR *dp;
-  dp = opendir("/sys/class/typec/");
+  dp = opendir(fsPath("/sys/class/typec/").c_str());
   if (dp != NULL) {
     struct dirent *ep;
 
@@ -427,11 +520,10 @@ static std::unordered_map<std::string, bool> getTypeCPortNamesHelper() {
   return names;
 }
 
-static bool canSwitchRoleHelper(const std::string &portName) {
-  std::string filename = "/sys/class/typec/" + portName + "-partner/supports_usb_power_delivery";
-  std::string supportsPD;
+static bool canSwitchRoleHelper(SysfsAttr &attr) {
+  char supportsPD[8];
 
-  if (ReadFileToString(filename, &supportsPD)) {
+  if (attr.read(supportsPD, sizeof(supportsPD)) > 0) {
     if (supportsPD[0] == 'y') {
       return true;
     }
@@ -440,124 +532,387 @@ static bool canSwitchRoleHelper(const std::string &portName) {
   return false;
 }
 
-Status Usb::getPortStatusHelper(std::vector<PortStatus> &currentPortStatus,
-    const std::string &contaminantStatusPath) {
+/*
+ * Re-read power_role and data_role of a port. Roles are reported as NONE
+ * while no partner is attached.
+ */
+static Status refreshPortRoles(TypecPortAttrs &attrs, TypecPortState &port) {
+  std::string_view roleName;
+  char buf[64];
+
+  port.powerRole = PortPowerRole::NONE;
+  port.dataRole = PortDataRole::NONE;
+
+  if (!port.connected)
+    return Status::SUCCESS;
+
+  if (readRoleHelper(attrs.powerRole, roleName, buf, sizeof(buf)) != Status::SUCCESS) {
+    ALOGE("Error while retrieving current power role");
+    return Status::ERROR;
+  }
+
+  if (roleName == "source") {
+    port.powerRole = PortPowerRole::SOURCE;
+  } else if (roleName == "sink") {
+    port.powerRole = PortPowerRole::SINK;
+  } else if (roleName != "none") {
+    ALOGE("Error while retrieving current power role");
+    return Status::UNRECOGNIZED_ROLE;
+  }
+
+  if (readRoleHelper(attrs.dataRole, roleName, buf, sizeof(buf)) != Status::SUCCESS) {
+    ALOGE("Error while retrieving current data role");
+    return Status::ERROR;
+  }
+
+  if (roleName == "host") {
+    port.dataRole = PortDataRole::HOST;
+  } else if (roleName == "device") {
+    port.dataRole = PortDataRole::DEVICE;
+  } else if (roleName != "none") {
+    ALOGE("Error while retrieving current data role");
+    return Status::UNRECOGNIZED_ROLE;
+  }
+
+  return Status::SUCCESS;
+}
+
+/*
+ * Re-read the attributes of <port>-partner that are reflected in
+ * PortStatus: accessory_mode and supports_usb_power_delivery.
+ */
+static Status refreshPartner(TypecPortAttrs &attrs, TypecPortState &port) {
+  std::string_view accessory;
+  char buf[64];
+
+  port.accessoryMode = PortMode::NONE;
+  port.canSwitchRole = false;
+
+  if (!port.connected)
+    return Status::SUCCESS;
+
+  if (getAccessoryConnected(attrs.accessoryMode, accessory, buf, sizeof(buf)) != Status::SUCCESS) {
+    ALOGE("Error while retrieving current mode");
+    return Status::ERROR;
+  }
+
+  if (accessory == "analog_audio")
+    port.accessoryMode = PortMode::AUDIO_ACCESSORY;
+  else if (accessory == "debug")
+    port.accessoryMode = PortMode::DEBUG_ACCESSORY;
+
+  port.canSwitchRole = canSwitchRoleHelper(attrs.supportsPd);
+  return Status::SUCCESS;
+}
+
+static PortMode currentModeHelper(const TypecPortState &port) {
+  if (!port.connected)
+    return PortMode::NONE;
+
+  if (port.accessoryMode != PortMode::NONE)
+    return port.accessoryMode;
+
+  if (port.dataRole == PortDataRole::HOST)
+    return PortMode::DFP;
+  else if (port.dataRole == PortDataRole::DEVICE)
+    return PortMode::UFP;
+
+  return PortMode::NONE;
+}
+
+// Read the moisture sensor at path, empty if the port has none
+static void refreshContaminant(TypecPortAttrs &attrs, TypecPortState &port,
+                               const std::string &path) {
+  char contaminantPresence[8];
+
+  if (attrs.contaminant.path() != path)
+    attrs.contaminant.setPath(path);
+
+  port.contaminantSupported = !path.empty() &&
+      attrs.contaminant.read(contaminantPresence, sizeof(contaminantPresence)) > 0;
+  port.contaminantPresent = port.contaminantSupported && contaminantPresence[0] == '1';
+}
+
+static void refreshPort(TypecPortAttrs &attrs, TypecPortState &port) {
+  port.status = refreshPartner(attrs, port);
+  if (port.status == Status::SUCCESS)
+    port.status = refreshPortRoles(attrs, port);
+}
+
+/*
+ * Split a typec uevent DEVPATH (.../typec/portN[/child]) into the port
+ * name and the child device, if any (portN-partner, portN-cable, ...).
+ */
+static bool parseTypecDevpath(std::string_view devpath, std::string_view &portName,
+                              std::string_view &child) {
+  size_t pos = devpath.find("typec/port");
+
+  if (pos == std::string_view::npos)
+    return false;
+
+  devpath.remove_prefix(pos + strlen("typec/"));
+  pos = devpath.find('/');
+  portName = devpath.substr(0, pos);
+  child = pos == std::string_view::npos ? std::string_view() : devpath.substr(pos + 1);
+
+  return !portName.empty();
+}
+
+bool Usb::isPortConnected(const std::string &portName) {
+  auto it = mPortState.find(portName);
+
+  return it != mPortState.end() && it->second.connected;
+}
+
+void Usb::resyncPortState() {
   auto names = getTypeCPortNamesHelper();
 
-  if (!names.empty()) {
-    currentPortStatus.resize(names.size());
-    int i = 0;
-    for (auto & [portName, connected] : names) {
-      ALOGI("%s", portName.c_str());
-      auto & status = currentPortStatus[i++];
-      status.portName = portName;
-
-      PortRole currentRole;
-      currentRole.set<PortRole::powerRole>(PortPowerRole::NONE);
-      if (getCurrentRoleHelper(portName, connected, currentRole) == Status::SUCCESS) {
-        status.currentPowerRole = currentRole.get<PortRole::powerRole>();
-      } else {
-        ALOGE("Error while retrieving current power role");
-        goto done;
-      }
+  mPortState.clear();
+  for (auto & [portName, connected] : names) {
+    TypecPortState &port = mPortState[portName];
+    TypecPortAttrs &attrs = mPortAttrs.try_emplace(portName, portName).first->second;
 
-      currentRole.set<PortRole::dataRole>(PortDataRole::NONE);
-      if (getCurrentRoleHelper(portName, connected, currentRole) == Status::SUCCESS) {
-        status.currentDataRole = currentRole.get<PortRole::dataRole>();
-      } else {
-        ALOGE("Error while retrieving current data role");
-        goto done;
-      }
+    port.connected = connected;
+    refreshPort(attrs, port);
+    refreshContaminant(attrs, port,
+                       portName == kContaminantPort ? mContaminantStatusPath : "");
+  }
 
-      currentRole.set<PortRole::mode>(PortMode::NONE);
-      if (getCurrentRoleHelper(portName, connected, currentRole) == Status::SUCCESS) {
-        status.currentMode = currentRole.get<PortRole::mode>();
-      } else {
-        ALOGE("Error while retrieving current mode");
-        goto done;
-      }
+  // drop the handles of ports that went away
+  for (auto it = mPortAttrs.begin(); it != mPortAttrs.end(); ) {
+    if (names.count(it->first))
+      ++it;
+    else
+      it = mPortAttrs.erase(it);
+  }
 
-      status.canChangeMode = true;
-      status.canChangeDataRole = connected ? canSwitchRoleHelper(portName) : false;
-      status.canChangePowerRole = connected ? canSwitchRoleHelper(portName) : false;
+  mPortStateStale = false;
+}
 
-      status.supportedModes.push_back(PortMode::DRP);
-      status.supportedModes.push_back(PortMode::AUDIO_ACCESSORY);
-      status.usbDataStatus.push_back(usbDataDisabled ? UsbDataStatus::DISABLED_FORCE :
-                                       UsbDataStatus::ENABLED);
+/*
+ * Bring the cached port state up to date and publish a copy of it for
+ * other threads. Ports that failed to read are retried on the next call.
+ */
+void Usb::syncPortState() {
+  if (mPortStateStale)
+    resyncPortState();
 
-      status.powerTransferLimited = limitedPower;
+  publishPortState();
 
-      ALOGI("%d:%s connected:%d canChangeMode:%d canChangeData:%d canChangePower:%d "
-            "usbDataDisabled:%d, powerTransferLimited:%d",
-            i, portName.c_str(), connected, status.canChangeMode,
-            status.canChangeDataRole, status.canChangePowerRole, usbDataDisabled,
-            limitedPower);
+  for (auto & [portName, port] : mPortState) {
+    if (port.status != Status::SUCCESS)
+      mPortStateStale = true;
+  }
+}
 
-      status.supportsEnableContaminantPresenceProtection = false;
-      status.supportsEnableContaminantPresenceDetection = false;
-      status.contaminantProtectionStatus = ContaminantProtectionStatus::FORCE_SINK;
+void Usb::publishPortState() {
+  auto start = std::chrono::steady_clock::now();
+  auto snapshot = std::make_shared<PortStateSnapshot>();
+  std::shared_ptr<const PortStateSnapshot> previous = portState();
 
-      if (portName != "port0") // moisture detection only on first port
-        continue;
+  snapshot->ports = mPortState;
+  snapshot->generation = previous ? previous->generation + 1 : 1;
+  snapshot->published = start;
+  std::atomic_store(&mPortSnapshot, std::shared_ptr<const PortStateSnapshot>(snapshot));
 
-      std::string contaminantPresence;
+  mPublishUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count());
+}
 
-      if (!contaminantStatusPath.empty() &&
-              ReadFileToString(contaminantStatusPath, &contaminantPresence)) {
-        status.supportedContaminantProtectionModes
-            .push_back(ContaminantProtectionMode::FORCE_SINK);
-        status.supportedContaminantProtectionModes
-            .push_back(ContaminantProtectionMode::FORCE_DISABLE);
+/*
+ * Fold a typec uevent into the cached port state. Only the attributes
+ * owned by the device that raised the event are re-read; anything that
+ * cannot be attributed (a port appearing or going away) forces a full
+ * resync on next use.
+ */
+void Usb::updatePortState(const Uevent &event) {
+  std::string_view portName, child;
 
-        if (contaminantPresence[0] == '1') {
-          status.contaminantDetectionStatus = ContaminantDetectionStatus::DETECTED;
-            ALOGI("moisture: Contaminant presence detected");
-        } else {
-            status.contaminantDetectionStatus = ContaminantDetectionStatus::NOT_DETECTED;
-        }
+  if (mPortStateStale)
+    return;
+
+  if (!parseTypecDevpath(event.devpath, portName, child)) {
+    mPortStateStale = true;
+    return;
+  }
+
+  auto it = mPortState.find(std::string(portName));
+  if (it == mPortState.end()) {
+    mPortStateStale = true;
+    return;
+  }
+
+  TypecPortState &port = it->second;
+
+  if (child.empty()) {
+    // role and power_operation_mode changes are reported on the port itself
+    if (event.action == "change")
+      port.status = refreshPortRoles(mPortAttrs.at(it->first), port);
+    else
+      mPortStateStale = true;
+  } else if (child.size() == portName.size() + strlen("-partner") &&
+             child.substr(0, portName.size()) == portName &&
+             child.substr(portName.size()) == "-partner") {
+    if (event.action == "add")
+      port.connected = true;
+    else if (event.action == "remove")
+      port.connected = false;
+
+    refreshPort(mPortAttrs.at(it->first), port);
+  }
+  // cable, plug and altmode devices carry nothing that PortStatus reports
+
+  if (port.status != Status::SUCCESS)
+    mPortStateStale = true;
+}
+
+/*
+ * Re-read the contaminant presence of the port covered by the moisture
+ * sensor on a POWER_SUPPLY uevent. Returns true if the presence changed.
+ */
+bool Usb::refreshContaminantState() {
+  auto it = mPortState.find(kContaminantPort);
+  bool present = it != mPortState.end() && it->second.contaminantPresent;
+
+  if (mPortStateStale) {
+    resyncPortState();
+    it = mPortState.find(kContaminantPort);
+  } else if (it != mPortState.end()) {
+    refreshContaminant(mPortAttrs.at(it->first), it->second, mContaminantStatusPath);
+  }
+
+  if (it == mPortState.end() || !it->second.contaminantSupported ||
+      it->second.contaminantPresent == present)
+    return false;
+
+  if (it->second.contaminantPresent)
+    mContaminantDetected++;
+  else
+    mContaminantCleared++;
+  return true;
+}
+
+/*
+ * Build PortStatus from the last published port state. Lock free, callable
+ * from any thread; the worker refreshes what it reads in syncPortState().
+ */
+Status Usb::getPortStatusHelper(std::vector<PortStatus> &currentPortStatus) {
+  std::shared_ptr<const PortStateSnapshot> snapshot = portState();
+  Status ret = Status::SUCCESS;
+
+  if (!snapshot || snapshot->ports.empty())
+    return Status::ERROR;
+
+  currentPortStatus.resize(snapshot->ports.size());
+  int i = 0;
+  for (auto & [portName, port] : snapshot->ports) {
+    auto & status = currentPortStatus[i++];
+    status.portName = portName;
+
+    if (port.status != Status::SUCCESS)
+      ret = Status::ERROR;
+
+    status.currentPowerRole = port.powerRole;
+    status.currentDataRole = port.dataRole;
+    status.currentMode = currentModeHelper(port);
+
+    status.canChangeMode = true;
+    status.canChangeDataRole = port.connected ? port.canSwitchRole : false;
+    status.canChangePowerRole = port.connected ? port.canSwitchRole : false;
+
+    status.supportedModes.push_back(PortMode::DRP);
+    status.supportedModes.push_back(PortMode::AUDIO_ACCESSORY);
+    status.usbDataStatus.push_back(usbDataDisabled ? UsbDataStatus::DISABLED_FORCE :
+                                     UsbDataStatus::ENABLED);
+
+    status.powerTransferLimited = limitedPower;
+
+    ALOGV("%d:%s connected:%d canChangeMode:%d canChangeData:%d canChangePower:%d "
+          "usbDataDisabled:%d, powerTransferLimited:%d",
+          i, portName.c_str(), port.connected, status.canChangeMode,
+          status.canChangeDataRole, status.canChangePowerRole, usbDataDisabled.load(),
+          limitedPower.load());
+
+    status.supportsEnableContaminantPresenceProtection = false;
+    status.supportsEnableContaminantPresenceDetection = false;
+    status.contaminantProtectionStatus = ContaminantProtectionStatus::FORCE_SINK;
+
+    if (port.contaminantSupported) {
+      status.supportedContaminantProtectionModes
+          .push_back(ContaminantProtectionMode::FORCE_SINK);
+      status.supportedContaminantProtectionModes
+          .push_back(ContaminantProtectionMode::FORCE_DISABLE);
+
+      if (port.contaminantPresent) {
+        status.contaminantDetectionStatus = ContaminantDetectionStatus::DETECTED;
+          ALOGI("moisture: Contaminant presence detected");
       } else {
-        status.supportedContaminantProtectionModes
-            .push_back(ContaminantProtectionMode::NONE);
-        status.contaminantProtectionStatus = ContaminantProtectionStatus::NONE;
+          status.contaminantDetectionStatus = ContaminantDetectionStatus::NOT_DETECTED;
       }
+    } else {
+      status.supportedContaminantProtectionModes
+          .push_back(ContaminantProtectionMode::NONE);
+      status.contaminantProtectionStatus = ContaminantProtectionStatus::NONE;
     }
-    return Status::SUCCESS;
   }
-done:
-  return Status::ERROR;
+
+  return ret;
 }
 
-ScopedAStatus Usb::queryPortStatus(int64_t in_transactionId) {
+/*
+ * Queue a port status snapshot for callback, dropped on delivery if it
+ * matches the last one unless always is set.
+ */
+void Usb::queuePortStatus(const std::shared_ptr<IUsbCallback> &callback, bool always) {
   std::vector<PortStatus> currentPortStatus;
+  Status status = getPortStatusHelper(currentPortStatus);
 
-  std::scoped_lock lock(mLock);
-  if (mCallback) {
-    Status status = getPortStatusHelper(currentPortStatus, mContaminantStatusPath);
-    ScopedAStatus ret = mCallback->notifyPortStatusChange(currentPortStatus, status);
-    if (!ret.isOk())
-      ALOGE("notifyPortStatusChange error %s", ret.getDescription().c_str());
+  mDispatcher.postPortStatus(callback, std::move(currentPortStatus), status, always);
+}
 
-    ret = mCallback->notifyQueryPortStatus("all", Status::SUCCESS, in_transactionId);
-    if (!ret.isOk())
-      ALOGE("notifyQueryPortStatus error %s", ret.getDescription().c_str());
-  } else {
-    ALOGE("Notifying userspace skipped. Callback is NULL");
-  }
+ScopedAStatus Usb::queryPortStatus(int64_t in_transactionId) {
+  auto query = [this, in_transactionId] {
+    std::shared_ptr<IUsbCallback> callback = currentCallback();
+
+    if (!callback) {
+      ALOGE("Notifying userspace skipped. Callback is NULL");
+      return;
+    }
+
+    queuePortStatus(callback, true);
+    mDispatcher.post(callback, "notifyQueryPortStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyQueryPortStatus("all", Status::SUCCESS, in_transactionId);
+        });
+  };
+
+  // The worker first refreshes port state left stale by a failed read;
+  // without it the last published state is all there is
+  if (!runOnWorker([this, query] {
+        SysfsStats &stats = SysfsAttr::stats();
+        uint64_t opens = stats.opens, reads = stats.reads;
+
+        syncPortState();
+        ALOGV("queryPortStatus: %llu sysfs opens, %llu reads",
+              (unsigned long long)(stats.opens - opens),
+              (unsigned long long)(stats.reads - reads));
+        query();
+      }))
+    query();
 
   return ScopedAStatus::ok();
 }
 
 ScopedAStatus Usb::enableContaminantPresenceDetection(const std::string& portName,
             bool enable, int64_t in_transactionId) {
-  std::vector<PortStatus> currentPortStatus;
-
-  std::scoped_lock lock(mLock);
-  if (mCallback && in_transactionId >= 0) {
-    ScopedAStatus ret = mCallback->notifyContaminantEnabledStatus(portName,
-		    true, Status::SUCCESS, in_transactionId);
-    if (!ret.isOk())
-      ALOGE("notifyContaminantEnabledStatus error %s", ret.getDescription().c_str());
+  std::shared_ptr<IUsbCallback> callback = currentCallback();
+
+  if (callback && in_transactionId >= 0) {
+    mDispatcher.post(callback, "notifyContaminantEnabledStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyContaminantEnabledStatus(portName, true, Status::SUCCESS,
+                                                    in_transactionId);
+        });
   }
 
   ALOGI("Contaminant Presence Detection should always be in enable mode");
@@ -565,71 +920,88 @@ ScopedAStatus Usb::enableContaminantPresenceDetection(const std::string& portNam
   return ScopedAStatus::ok();
 }
 
-static void handle_typec_uevent(Usb *usb, const char *msg)
+/*
+ * Re-read power_operation_mode of a port after one of its typec uevents.
+ * A USB PD contract leaves the device self powered, so the gadget's
+ * configuration descriptor claims no bus power while one is up. The first
+ * port to reach usb_power_delivery saves and zeroes the descriptor and
+ * only that port restores it, so other ports never touch the gadget.
+ */
+void Usb::updatePowerOpMode(const std::string &portName, bool removed) {
+  std::string mode;
+
+  if (removed) {
+    mPortPower.erase(portName);
+  } else {
+    TypecPortPower &power = mPortPower.try_emplace(portName, portName).first->second;
+
+    if (!power.opModeAttr.read(&mode))
+      return;
+
+    if (power.opMode == mode) {
+      ALOGV("uevent recieved for same device %s", mode.c_str());
+      return;
+    }
+    power.opMode = mode;
+  }
+
+  if (mode == "usb_power_delivery") {
+    if (!mGadgetPowerPort.empty())
+      return;
+
+    ReadFileToString(fsPath(GADGET_CONFIG_PATH "MaxPower"), &mMaxPower);
+    ReadFileToString(fsPath(GADGET_CONFIG_PATH "bmAttributes"), &mAttributes);
+    WriteStringToFile("0", fsPath(GADGET_CONFIG_PATH "MaxPower"));
+    WriteStringToFile("0xc0", fsPath(GADGET_CONFIG_PATH "bmAttributes"));
+    mGadgetPowerPort = portName;
+  } else if (mGadgetPowerPort == portName) {
+    if (!mMaxPower.empty()) {
+      WriteStringToFile(mMaxPower, fsPath(GADGET_CONFIG_PATH "MaxPower"));
+      WriteStringToFile(mAttributes, fsPath(GADGET_CONFIG_PATH "bmAttributes"));
+      mMaxPower = "";
+    }
+    mGadgetPowerPort.clear();
+  }
+}
+
+static void handle_typec_uevent(Usb *usb, const char *msg, const Uevent &event)
 {
-  ALOGI("uevent received %s", msg);
+  std::string_view portName, child;
+  bool hasPort = parseTypecDevpath(event.devpath, portName, child);
+
+  ALOGV("uevent received %s", msg);
+
+  usb->updatePortState(event);
 
   // if (std::regex_match(cp, std::regex("(add)(.*)(-partner)")))
   if (!strncmp(msg, "add@", 4) && !strncmp(msg + strlen(msg) - 8, "-partner", 8)) {
-     ALOGI("partner added");
-     std::scoped_lock lock(usb->mPartnerLock);
-     usb->mPartnerUp = true;
-     usb->mPartnerCV.notify_one();
-  }
-
-  std::string power_operation_mode;
-  if (ReadFileToString("/sys/class/typec/port0/power_operation_mode", &power_operation_mode)) {
-    power_operation_mode = Trim(power_operation_mode);
-    if (usb->mPowerOpMode == power_operation_mode) {
-      ALOGI("uevent recieved for same device %s", power_operation_mode.c_str());
-    } else if(power_operation_mode == "usb_power_delivery") {
-      ReadFileToString("/config/usb_gadget/g1/configs/b.1/MaxPower", &usb->mMaxPower);
-      ReadFileToString("/config/usb_gadget/g1/configs/b.1/bmAttributes", &usb->mAttributes);
-      WriteStringToFile("0", "/config/usb_gadget/g1/configs/b.1/MaxPower");
-      WriteStringToFile("0xc0", "/config/usb_gadget/g1/configs/b.1/bmAttributes");
-    } else {
-      if(!usb->mMaxPower.empty()) {
-        WriteStringToFile(usb->mMaxPower, "/config/usb_gadget/g1/configs/b.1/MaxPower");
-        WriteStringToFile(usb->mAttributes, "/config/usb_gadget/g1/configs/b.1/bmAttributes");
-        usb->mMaxPower = "";
-      }
-    }
-
-    usb->mPowerOpMode = power_operation_mode;
+    ALOGI("partner added");
+    if (hasPort)
+      usb->roleSwitchPartnerAdded(std::string(portName));
   }
 
+  if (hasPort)
+    usb->updatePowerOpMode(std::string(portName), child.empty() && event.action == "remove");
+
+  usb->syncPortState();
+
   std::vector<PortStatus> currentPortStatus;
-  {
-    std::scoped_lock lock(usb->mLock);
-    if (usb->mCallback) {
-      Status status = usb->getPortStatusHelper(currentPortStatus, usb->mContaminantStatusPath);
-      ScopedAStatus ret = usb->mCallback->notifyPortStatusChange(currentPortStatus, status);
-      if (!ret.isOk())
-        ALOGE("notifyPortStatusChange error %s", ret.getDescription().c_str());
-    }
+  std::shared_ptr<IUsbCallback> callback = usb->currentCallback();
+  if (callback) {
+    Status status = usb->getPortStatusHelper(currentPortStatus);
+    usb->mDispatcher.postPortStatus(callback, currentPortStatus, status);
   }
 
   //Role switch is not in progress and port is in disconnected state
-  std::unique_lock role_lock(usb->mRoleSwitchLock, std::defer_lock);
-  if (role_lock.try_lock()) {
-    for (auto port : currentPortStatus) {
-      DIR *dp = opendir(std::string("/sys/class/typec/" + port.portName + "-partner").c_str());
-      if (dp == NULL) {
-        switchToDrp(port.portName);
-      } else {
-        closedir(dp);
-      }
-    }
+  for (auto port : currentPortStatus) {
+    if (!usb->roleSwitchActive(port.portName) && !usb->isPortConnected(port.portName))
+      switchToDrp(port.portName);
   }
 }
 
 // process POWER_SUPPLY uevent for contaminant presence
 static void handle_psy_uevent(Usb *usb, const char *msg)
 {
-  std::vector<PortStatus> currentPortStatus;
-  bool moisture_detected;
-  std::string contaminantPresence;
-
   while (*msg) {
     if (!strncmp(msg, "POWER_SUPPLY_NAME=", 18)) {
       msg += 18;
@@ -643,125 +1015,95 @@ static void handle_psy_uevent(Usb *usb, const char *msg)
     while (*msg++) ;
   }
 
-  // read moisture detection status from sysfs
-  if (usb->mContaminantStatusPath.empty() ||
-        !ReadFileToString(usb->mContaminantStatusPath, &contaminantPresence))
-    return;
-
-  moisture_detected = (contaminantPresence[0] == '1');
+  if (usb->refreshContaminantState()) {
+    std::shared_ptr<IUsbCallback> callback = usb->currentCallback();
 
-  if (usb->mContaminantPresence != moisture_detected) {
-    usb->mContaminantPresence = moisture_detected;
-
-    std::scoped_lock lock(usb->mLock);
-    if (usb->mCallback) {
-      Status status = usb->getPortStatusHelper(currentPortStatus, usb->mContaminantStatusPath);
-      ScopedAStatus ret = usb->mCallback->notifyPortStatusChange(currentPortStatus, status);
-      if (!ret.isOk())
-        ALOGE("notifyPortStatusChange error %s", ret.getDescription().c_str());
-    }
+    usb->syncPortState();
+    if (callback)
+      usb->queuePortStatus(callback);
   }
 }
 
-static void uevent_event(const unique_fd &uevent_fd, struct Usb *usb) {
-  constexpr int UEVENT_MSG_LEN = 2048;
-  char msg[UEVENT_MSG_LEN + 2];
-  int n, ret;
-  std::string dwc3_sysfs;
+/*
+ * Bind the UDC to the ConfigFS gadget, retrying every 50ms from the worker's
+ * timer queue until it sticks or the retries run out.
+ */
+static void bindUdc(Usb *usb, const std::string &gadgetName, int retry) {
+  std::string udcName;
 
-  std::string gadgetName = GetProperty(USB_CONTROLLER_PROP, "");
-  static std::regex add_regex("add@(/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/"
-                              "usb\\d/\\d-\\d(?:/[\\d\\.-]+)*)");
-  static std::regex remove_regex("remove@((/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/"
-                              "usb\\d)/\\d-\\d(?:/[\\d\\.-]+)*)");
-  static std::regex bind_regex("bind@(/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/"
-                               "usb\\d/\\d-\\d(?:/[\\d\\.-]+)*)/([^/]*:[^/]*)");
-  static std::regex bus_reset_regex("change@(/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/"
-                               "usb\\d/\\d-\\d(?:/[\\d\\.-]+)*)/([^/]*:[^/]*)");
-  static std::regex udc_regex("(add|remove)@/devices/platform/soc/.*/" + gadgetName +
-                              "/udc/" + gadgetName);
-  static std::regex offline_regex("offline@(/devices/platform/.*dwc3/xhci-hcd\\.\\d\\.auto/usb.*)");
-  static std::regex dwc3_regex("\\/(\\w+.\\w+usb)/.*dwc3");
-
-  n = uevent_kernel_multicast_recv(uevent_fd.get(), msg, UEVENT_MSG_LEN);
-  if (n <= 0) return;
-  if (n >= UEVENT_MSG_LEN) /* overflow -- discard */
+  WriteStringToFile(gadgetName, fsPath(GADGET_UDC_PATH));
+  ReadFileToString(fsPath(GADGET_UDC_PATH), &udcName);
+  if (Trim(udcName) == gadgetName || retry == 0)
     return;
 
-  msg[n] = '\0';
-  msg[n + 1] = '\0';
-
-  std::cmatch match;
-  if (strstr(msg, "typec/port")) {
-    handle_typec_uevent(usb, msg);
-  } else if (strstr(msg, "power_supply/usb")) {
-    handle_psy_uevent(usb, msg + strlen(msg) + 1);
-  } else if (std::regex_match(msg, match, add_regex)) {
-    if (match.size() == 2) {
-      std::csub_match submatch = match[1];
-      checkUsbDeviceAutoSuspend("/sys" +  submatch.str());
-    }
-  } else if (!usb->mIgnoreWakeup && std::regex_match(msg, match, bind_regex)) {
-    if (match.size() == 3) {
-      std::csub_match devpath = match[1];
-      std::csub_match intfpath = match[2];
-      checkUsbInterfaceAutoSuspend("/sys" + devpath.str(), intfpath.str());
+  ALOGI("Retrying UDC bind for %s", gadgetName.c_str());
+  usb->runAfter(std::chrono::milliseconds(50),
+      [usb, gadgetName, retry] { bindUdc(usb, gadgetName, retry - 1); });
+}
+
+static void uevent_event(struct Usb *usb, const char *msg, const Uevent &event,
+                         const std::string &gadgetName) {
+  int ret;
+
+  switch (event.type) {
+  case UeventType::TYPEC:
+    handle_typec_uevent(usb, msg, event);
+    break;
+  case UeventType::PSY:
+    handle_psy_uevent(usb, event.env);
+    break;
+  case UeventType::XHCI_DEVICE_ADD:
+    checkUsbDeviceAutoSuspend(fsPath("/sys") + std::string(event.devicePath));
+    break;
+  case UeventType::XHCI_INTERFACE_BIND:
+    if (!usb->mIgnoreWakeup)
+      checkUsbInterfaceAutoSuspend(fsPath("/sys") + std::string(event.devicePath),
+                                   std::string(event.interface));
+    break;
+  case UeventType::UDC_ADD:
+    usb->mControllers.invalidate();
+
+    // Allow ADBD to resume its FFS monitor thread
+    SetProperty(VENDOR_USB_ADB_DISABLED_PROP, "0");
+
+    // In case ADB is not enabled, we need to manually re-bind the UDC to
+    // ConfigFS since ADBD is not there to trigger it (sys.usb.ffs.ready=1)
+    if (GetProperty("init.svc.adbd", "") != "running") {
+      ALOGI("Binding UDC %s to ConfigFS", gadgetName.c_str());
+      bindUdc(usb, gadgetName, 5);
     }
-  } else if (std::regex_match(msg, match, udc_regex)) {
-    if (!strncmp(msg, "add", 3)) {
-      // Allow ADBD to resume its FFS monitor thread
-      SetProperty(VENDOR_USB_ADB_DISABLED_PROP, "0");
-
-      // In case ADB is not enabled, we need to manually re-bind the UDC to
-      // ConfigFS since ADBD is not there to trigger it (sys.usb.ffs.ready=1)
-      if (GetProperty("init.svc.adbd", "") != "running") {
-        std::string udcName;
-        int retry = 5;
-
-        ALOGI("Binding UDC %s to ConfigFS", gadgetName.c_str());
-
-        while (retry >= 0) {
-          WriteStringToFile(gadgetName, "/config/usb_gadget/g1/UDC");
-          ReadFileToString("/config/usb_gadget/g1/UDC", &udcName);
-          if (Trim(udcName) == gadgetName)
-            break;
-          ALOGI("Retrying UDC bind for %s", gadgetName.c_str());
-          std::this_thread::sleep_for(std::chrono::milliseconds(50));
-          retry--;
+    break;
+  case UeventType::UDC_REMOVE: {
+    usb->mControllers.invalidate();
+
+    // When the UDC is removed, the ConfigFS gadget will no longer be
+    // bound. If ADBD is running it would keep opening/writing to its
+    // FFS EP0 file but since FUNCTIONFS_BIND doesn't happen it will
+    // just keep repeating this in a 1 second retry loop. Each iteration
+    // will re-trigger a ConfigFS UDC bind which will keep failing.
+    // Setting this property stops ADBD from proceeding with the retry.
+
+    DIR *dir = opendir(fsPath(USB_UDC_PATH).c_str());
+    bool udc_found = false;
+
+    // enumerate /sys/class/udc/* to see if any UDCs still exist
+    if (dir != NULL) {
+      struct dirent *entity;
+
+      while ((entity = readdir(dir))) {
+        if (entity->d_type == DT_LNK){
+          udc_found = true;
+          break;
         }
       }
-    } else {
-      // When the UDC is removed, the ConfigFS gadget will no longer be
-      // bound. If ADBD is running it would keep opening/writing to its
-      // FFS EP0 file but since FUNCTIONFS_BIND doesn't happen it will
-      // just keep repeating this in a 1 second retry loop. Each iteration
-      // will re-trigger a ConfigFS UDC bind which will keep failing.
-      // Setting this property stops ADBD from proceeding with the retry.
-
-      DIR *dir = opendir(USB_UDC_PATH);
-      bool udc_found = false;
-
-      // enumerate /sys/class/udc/* to see if any UDCs still exist
-      if (dir != NULL) {
-	      struct dirent *entity;
-
-	      while ((entity = readdir(dir))) {
-		      if (entity->d_type == DT_LNK){
-			      udc_found = true;
-			      break;
-		      }
-	      }
-	      closedir(dir);
-      }
-
-      if (!udc_found)
-	      SetProperty(VENDOR_USB_ADB_DISABLED_PROP, "1");
-
+      closedir(dir);
     }
- } else if (std::regex_match(msg, match, bus_reset_regex)) {
-    std::csub_match devpath = match[1];
-    std::csub_match intfpath = match[2];
 
+    if (!udc_found)
+      SetProperty(VENDOR_USB_ADB_DISABLED_PROP, "1");
+    break;
+  }
+  case UeventType::XHCI_INTERFACE_CHANGE:
     ALOGI("Handling USB bus reset recovery");
 
     // Limit the recovery to when an audio device is connected directly to
@@ -769,30 +1111,108 @@ static void uevent_event(const unique_fd &uevent_fd, struct Usb *usb) {
     // related devices don't trigger the disconnectMon. (unbind uevent occurs
     // after sysfs files are cleaned, can't check bInterfaceClass)
     usb->usbResetRecov = 1;
-    ret = WriteStringToFile("0", "/sys" + devpath.str() + "/../authorized");
+    ret = WriteStringToFile("0", fsPath("/sys") + std::string(event.devicePath) +
+                            "/../authorized");
     if (!ret)
       ALOGI("unable to deauthorize device");
-  } else if (std::regex_match(msg, match, remove_regex)) {
-    std::csub_match devpath = match[1];
-    std::csub_match parentpath = match[2];
-
+    break;
+  case UeventType::XHCI_DEVICE_REMOVE:
     ALOGI("Disconnect received");
     if (usb->usbResetRecov) {
       usb->usbResetRecov = 0;
       //Allow interfaces to disconnect
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      WriteStringToFile("1", "/sys" + parentpath.str() + "/authorized");
+      usb->runAfter(std::chrono::milliseconds(100),
+          [busPath = fsPath("/sys") + std::string(event.busPath)] {
+            WriteStringToFile("1", busPath + "/authorized");
+          });
     }
+    break;
+  case UeventType::CONTROLLER_CHANGE:
+    usb->mControllers.invalidate();
+    break;
+  default:
+    break;
   }
 }
 
+/*
+ * Handle every message queued on the uevent socket before going back to
+ * epoll_wait(), so that a burst (e.g. a dock being plugged in) costs one
+ * wakeup instead of one per message.
+ */
+void Usb::uevent_drain(const unique_fd &uevent_fd) {
+  std::string gadgetName = GetProperty(USB_CONTROLLER_PROP, "");
+  uint32_t handled = 0;
+  int n;
+
+  auto wakeup = std::chrono::steady_clock::now();
+
+  while ((n = mUeventRx->receive(uevent_fd.get())) > 0) {
+    for (int i = 0; i < mUeventRx->count(); i++) {
+      const char *msg = mUeventRx->message(i);
+      Uevent event;
+
+      auto start = std::chrono::steady_clock::now();
+      size_t type = static_cast<size_t>(classifyUevent(msg, gadgetName, &event));
+      auto parsed = std::chrono::steady_clock::now();
+
+      uevent_event(this, msg, event, gadgetName);
+
+      auto end = std::chrono::steady_clock::now();
+      uint32_t queued = std::chrono::duration_cast<std::chrono::microseconds>(
+          start - wakeup).count();
+      uint32_t took = std::chrono::duration_cast<std::chrono::microseconds>(
+          end - parsed).count();
+
+      mUeventStats.count[type]++;
+      mUeventStats.parseNs[type].record(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(parsed - start).count());
+      mUeventStats.handleUs[type].record(took);
+      if (queued > mUeventStats.maxQueueUs)
+        mUeventStats.maxQueueUs = queued;
+      if (took > mUeventStats.maxHandleUs)
+        mUeventStats.maxHandleUs = took;
+    }
+
+    handled += mUeventRx->count();
+    if (n < UeventBatchReceiver::kBatchSize)
+      break;
+  }
+
+  if (n < 0)
+    ALOGE("uevent recvmmsg failed; errno=%d", errno);
+
+  mUeventStats.wakeups++;
+  mUeventStats.messages += handled;
+  mUeventStats.lastBatch = handled;
+  if (handled > mUeventStats.maxBatch)
+    mUeventStats.maxBatch = handled;
+
+  if (handled > 1)
+    ALOGV("handled %u uevents in one wakeup", handled);
+}
+
 void Usb::uevent_work() {
   struct epoll_event ev;
   int nevents = 0;
 
   ALOGE("creating thread");
 
-  unique_fd uevent_fd(uevent_open_socket(64 * 1024, true));
+  // USB_HAL_UEVENT_REPLAY feeds a recorded trace instead of the kernel's
+  // uevents; USB_HAL_UEVENT_REPLAY_FAST=1 ignores its recorded delays.
+  // The feeder is stopped and joined when the worker exits.
+  const char *replay = getenv("USB_HAL_UEVENT_REPLAY");
+  UeventReplay replayer;
+  unique_fd uevent_fd;
+
+  if (replay) {
+    const char *fast = getenv("USB_HAL_UEVENT_REPLAY_FAST");
+
+    ALOGI("replaying uevents from %s", replay);
+    uevent_fd = replayer.open(replay, !fast || strcmp(fast, "1"));
+  } else {
+    uevent_fd.reset(uevent_open_socket(64 * 1024, true));
+  }
 
   if (uevent_fd < 0) {
     ALOGE("uevent_init: uevent_open_socket failed\n");
@@ -800,6 +1220,7 @@ void Usb::uevent_work() {
   }
 
   fcntl(uevent_fd.get(), F_SETFL, O_NONBLOCK);
+  mUeventRx = std::make_unique<UeventBatchReceiver>(replay == nullptr);
 
   unique_fd epoll_fd(epoll_create(64));
   if (epoll_fd == -1) {
@@ -814,20 +1235,65 @@ void Usb::uevent_work() {
     return;
   }
 
-  mEventFd = unique_fd(eventfd(0, 0));
-  if (mEventFd == -1) {
-    ALOGE("eventfd failed; errno=%d\n", errno);
-    return;
-  }
-
+  // mEventFd is created by setCallback() before starting this thread
   ev.events = EPOLLIN;
   ev.data.fd = mEventFd.get();
   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mEventFd, &ev) == -1) {
     ALOGE("epoll_ctl adding event_fd failed; errno=%d", errno);
-    mEventFd.reset();
     return;
   }
 
+  ev.events = EPOLLIN;
+  ev.data.fd = mTaskFd.get();
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mTaskFd, &ev) == -1) {
+    ALOGE("epoll_ctl adding task_fd failed; errno=%d", errno);
+    return;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.fd = mTimerQueue.fd();
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mTimerQueue.fd(), &ev) == -1) {
+    ALOGE("epoll_ctl adding timer_fd failed; errno=%d", errno);
+    return;
+  }
+
+  {
+    std::scoped_lock lock(mTaskLock);
+    mWorkerRunning = true;
+  }
+
+  /*
+   * Check for the correct path to detect contaminant presence status
+   * from the possible paths and use that to get contaminant
+   * presence status when required.
+   */
+  static const char *const contaminantPaths[] = {
+    "/sys/class/power_supply/usb/moisture_detected",
+    "/sys/class/qcom-battery/moisture_detection_status",
+    "/sys/bus/iio/devices/iio:device4/in_index_usb_moisture_detected_input",
+  };
+
+  mContaminantStatusPath.clear();
+  for (const char *path : contaminantPaths) {
+    if (access(fsPath(path).c_str(), R_OK) == 0) {
+      mContaminantStatusPath = fsPath(path);
+      break;
+    }
+  }
+
+  ALOGI("Contamination presence path: %s", mContaminantStatusPath.c_str());
+
+  // uevents were not tracked while no callback was registered
+  mPortStateStale = true;
+  syncPortState();
+
+  // Done here rather than in setCallback() so that registering the
+  // callback does not wait on sysfs
+  checkUsbInHostMode();
+  mIgnoreWakeup = checkUsbWakeupSupport();
+  if (!mIgnoreWakeup)
+    startAutosuspendScan();
+
   bool running = true;
   while (running) {
     struct epoll_event events[64];
@@ -839,9 +1305,18 @@ void Usb::uevent_work() {
       break;
     }
 
+    auto wakeup = std::chrono::steady_clock::now();
+    mWorkerStats.wakeups++;
+
     for (int n = 0; n < nevents; ++n) {
       if (events[n].data.fd == uevent_fd.get()) {
-        uevent_event(uevent_fd, this);
+        uevent_drain(uevent_fd);
+      } else if (events[n].data.fd == mTaskFd.get()) {
+        mWorkerStats.taskWakeups++;
+        runTasks();
+      } else if (events[n].data.fd == mTimerQueue.fd()) {
+        mWorkerStats.timerWakeups++;
+        mTimerQueue.run();
       } else {
         eventfd_t val;
         ALOGI("eventfd notified");
@@ -850,15 +1325,48 @@ void Usb::uevent_work() {
         break;
       }
     }
+
+    mWorkerStats.busyUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - wakeup).count());
   }
 
   ALOGI("exiting worker thread");
+  {
+    std::scoped_lock lock(mTaskLock);
+    mWorkerRunning = false;
+  }
+
+  // Requests runOnWorker() accepted still run, and the pending timers
+  // restore what they were due to, e.g. the mode of a port being reset
+  runTasks();
+  abortRoleSwitches();
+  mScanPending.clear();
+  mTimerQueue.drain();
+}
+
+/*
+ * Stop the worker and wait for it, if there is one. Called with mLock
+ * held, so that a concurrent setCallback() can never start a second
+ * worker next to one still exiting.
+ */
+void Usb::stopWorker() {
+  if (!mPoll.joinable())
+    return;
+
+  // Also fine if the worker gave up starting and has returned already
+  if (eventfd_write(mEventFd, 1))
+    ALOGE("worker stop eventfd write failed; errno=%d", errno);
+  mPoll.join();
   mEventFd.reset();
+  ALOGI("worker thread destroyed");
 }
 
 ScopedAStatus Usb::setCallback(const std::shared_ptr<IUsbCallback>& callback) {
+  TimedLockGuard lock(mLock, mLockHoldUs);
+  bool hadCallback = currentCallback() != NULL;
+
+  std::atomic_store(&mCallback, callback);
 
-  std::unique_lock lock(mLock);
   /*
    * When both the old callback and new callback values are NULL,
    * there is no need to spin off the worker thread.
@@ -866,62 +1374,35 @@ ScopedAStatus Usb::setCallback(const std::shared_ptr<IUsbCallback>& callback) {
    * worker thread running, so updating the callback object would
    * be suffice.
    */
-  if ((mCallback == NULL && callback == NULL) ||
-      (mCallback != NULL && callback != NULL)) {
-    mCallback = callback;
+  if (hadCallback == (callback != NULL))
     return ScopedAStatus::ok();
-  }
 
-  mCallback = callback;
   ALOGI("registering callback");
 
-  // Kill the worker thread if the new callback is NULL.
-  if (mCallback == NULL) {
-    lock.unlock();
-    eventfd_t val = 1;
-    if (eventfd_write(mEventFd, val) == 0) {
-      mPoll.join();
-      ALOGI("worker thread destroyed");
-    }
+  // Kill the worker thread if the new callback is NULL. Starting one never
+  // leaves an old worker behind either.
+  stopWorker();
+  if (callback == NULL)
     return ScopedAStatus::ok();
-  }
-
-  if (mPoll.joinable()) {
-    ALOGE("worker thread still running; detaching...");
-    mPoll.detach();
-  }
 
   /*
    * Create a background thread if the old callback value is NULL
-   * and being updated with a new value.
-   */
-  mPoll = std::thread(&Usb::uevent_work, this);
-
-  mIgnoreWakeup = checkUsbWakeupSupport();
-  checkUsbInHostMode();
-
-  /*
-   * Check for the correct path to detect contaminant presence status
-   * from the possible paths and use that to get contaminant
-   * presence status when required.
+   * and being updated with a new value. Its stop eventfd exists before
+   * it does, so that it can always be stopped.
    */
-  if (access("/sys/class/power_supply/usb/moisture_detected", R_OK) == 0) {
-    mContaminantStatusPath = "/sys/class/power_supply/usb/moisture_detected";
-  } else if (access("/sys/class/qcom-battery/moisture_detection_status", R_OK) == 0) {
-    mContaminantStatusPath = "/sys/class/qcom-battery/moisture_detection_status";
-  } else if (access("/sys/bus/iio/devices/iio:device4/in_index_usb_moisture_detected_input", R_OK) == 0) {
-    mContaminantStatusPath = "/sys/bus/iio/devices/iio:device4/in_index_usb_moisture_detected_input";
-  } else {
-    mContaminantStatusPath.clear();
+  mEventFd = unique_fd(eventfd(0, EFD_CLOEXEC));
+  if (mEventFd == -1) {
+    ALOGE("eventfd failed; errno=%d", errno);
+    return ScopedAStatus::ok();
   }
 
-  ALOGI("Contamination presence path: %s", mContaminantStatusPath.c_str());
+  mPoll = std::thread(&Usb::uevent_work, this);
 
   return ScopedAStatus::ok();
 }
 
 static void checkUsbInHostMode() {
-  std::string gadgetName = "/sys/bus/platform/devices/" + GetProperty(USB_CONTROLLER_PROP, "");
+  std::string gadgetName = fsPath(USB_MODE_PATH) + GetProperty(USB_CONTROLLER_PROP, "");
   DIR *gd = opendir(gadgetName.c_str());
   if (gd != NULL) {
     struct dirent *gadgetDir;
@@ -938,7 +1419,7 @@ static void checkUsbInHostMode() {
 }
 
 static bool checkUsbWakeupSupport() {
-  std::string platdevices = "/sys/bus/platform/devices/";
+  std::string platdevices = fsPath(USB_MODE_PATH);
   DIR *pd = opendir(platdevices.c_str());
   bool ignoreWakeup = true;
 
@@ -964,52 +1445,96 @@ static bool checkUsbWakeupSupport() {
     closedir(pd);
   }
 
-  if (ignoreWakeup)
-    return true;
+  return ignoreWakeup;
+}
 
-  /*
-   * If wakeup is supported then scan for enumerated USB devices and
-   * enable autosuspend.
-   */
-  std::string usbdevices = "/sys/bus/usb/devices/";
+// Enable autosuspend on the first interface of a /sys/bus/usb/devices entry that allows it
+static void checkUsbDeviceInterfacesAutoSuspend(const std::string &deviceLink) {
+  struct dirent *intfDir;
+  char buf[PATH_MAX];
+  DIR *ip;
+
+  if (!realpath(deviceLink.c_str(), buf))
+    return;
+
+  ip = opendir(buf);
+  if (ip == NULL)
+    return;
+
+  while ((intfDir = readdir(ip))) {
+    // Scan over all the interfaces that are part of the device
+    if (intfDir->d_type == DT_DIR && strchr(intfDir->d_name, ':')) {
+      /*
+       * If the autosuspend is successfully enabled, no need
+       * to iterate over other interfaces.
+       */
+      if (checkUsbInterfaceAutoSuspend(buf, intfDir->d_name))
+        break;
+    }
+  }
+  closedir(ip);
+}
+
+/*
+ * Enable autosuspend on the USB devices enumerated before the worker
+ * started. Runs on the worker a slice at a time, so that uevents and
+ * binder tasks are not held up behind a large hub tree; devices that show
+ * up meanwhile are handled by their own uevents.
+ */
+void Usb::startAutosuspendScan() {
+  std::string usbdevices = fsPath("/sys/bus/usb/devices/");
   DIR *dp = opendir(usbdevices.c_str());
+
+  mScanPending.clear();
+  mScanStart = std::chrono::steady_clock::now();
+  mScanStats.devices = 0;
+  mScanStats.slices = 0;
+  mScanStats.totalUs = 0;
+
   if (dp != NULL) {
     struct dirent *deviceDir;
-    struct dirent *intfDir;
-    DIR *ip;
 
+    // devices only, not their interfaces
     while ((deviceDir = readdir(dp))) {
-      /*
-       * Iterate over all the devices connected over USB while skipping
-       * the interfaces.
-       */
-      if (deviceDir->d_type == DT_LNK && !strchr(deviceDir->d_name, ':')) {
-        char buf[PATH_MAX];
-        if (realpath((usbdevices + deviceDir->d_name).c_str(), buf)) {
-
-          ip = opendir(buf);
-          if (ip == NULL)
-            continue;
-
-          while ((intfDir = readdir(ip))) {
-            // Scan over all the interfaces that are part of the device
-            if (intfDir->d_type == DT_DIR && strchr(intfDir->d_name, ':')) {
-              /*
-               * If the autosuspend is successfully enabled, no need
-               * to iterate over other interfaces.
-               */
-              if (checkUsbInterfaceAutoSuspend(buf, intfDir->d_name))
-                break;
-            }
-          }
-          closedir(ip);
-        }
-      }
+      if (deviceDir->d_type == DT_LNK && !strchr(deviceDir->d_name, ':'))
+        mScanPending.push_back(deviceDir->d_name);
     }
     closedir(dp);
   }
 
-  return ignoreWakeup;
+  autosuspendScanSlice();
+}
+
+void Usb::autosuspendScanSlice() {
+  auto sliceStart = std::chrono::steady_clock::now();
+  auto now = sliceStart;
+
+  mScanStats.slices++;
+  while (!mScanPending.empty() && now - sliceStart < kAutosuspendScanSlice) {
+    std::string device = std::move(mScanPending.front());
+
+    mScanPending.pop_front();
+    checkUsbDeviceInterfacesAutoSuspend(fsPath("/sys/bus/usb/devices/") + device);
+
+    auto end = std::chrono::steady_clock::now();
+    long long took = std::chrono::duration_cast<std::chrono::microseconds>(end - now).count();
+
+    ALOGV("autosuspend scan %s: %lldus", device.c_str(), took);
+    mScanStats.deviceUs.record(took);
+    mScanStats.devices++;
+    now = end;
+  }
+
+  if (!mScanPending.empty()) {
+    runOnWorker([this] { autosuspendScanSlice(); });
+    return;
+  }
+
+  mScanStats.totalUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      now - mScanStart).count();
+  ALOGI("autosuspend scan: %u devices in %lluus over %u slices, slowest %lluus",
+        mScanStats.devices.load(), (unsigned long long)mScanStats.totalUs,
+        mScanStats.slices.load(), (unsigned long long)mScanStats.deviceUs.max());
 }
 
 static int getDeviceInterfaceClass(const std::string& devicePath,
@@ -1092,26 +1617,26 @@ static bool checkUsbInterfaceAutoSuspend(const std::string& devicePath,
 
 ScopedAStatus Usb::limitPowerTransfer(const std::string& in_portName, bool in_limit,
     int64_t in_transactionId) {
-  std::scoped_lock lock(mLock);
   aidl::android::hardware::usb::Status status = Status::SUCCESS;
+  std::shared_ptr<IUsbCallback> callback;
   int ret;
 
   ALOGI("limitPowerTransfer in_limit: %d", in_limit);
 
   if (in_limit) {
-    ret = WriteStringToFile("0", "/sys/class/qcom-battery/restrict_cur");
+    ret = WriteStringToFile("0", fsPath("/sys/class/qcom-battery/restrict_cur"));
     if (!ret) {
       ALOGE("failed to limit USB charge current");
       status = Status::ERROR;
     }
 
-    ret = WriteStringToFile("1", "/sys/class/qcom-battery/restrict_chg");
+    ret = WriteStringToFile("1", fsPath("/sys/class/qcom-battery/restrict_chg"));
     if (!ret) {
       ALOGE("failed to limit USB charge current");
       status = Status::ERROR;
     }
   } else {
-    ret = WriteStringToFile("0", "/sys/class/qcom-battery/restrict_chg");
+    ret = WriteStringToFile("0", fsPath("/sys/class/qcom-battery/restrict_chg"));
     if (!ret) {
       ALOGE("failed to de-limit USB charge current");
       status = Status::ERROR;
@@ -1120,18 +1645,15 @@ ScopedAStatus Usb::limitPowerTransfer(const std::string& in_portName, bool in_li
 
   limitedPower = in_limit;
 
-  if (mCallback && in_transactionId >= 0) {
-    std::vector<PortStatus> currentPortStatus;
-    ScopedAStatus ret = mCallback->notifyLimitPowerTransferStatus(in_portName,
-        in_limit, status, in_transactionId);
-    if (!ret.isOk())
-      ALOGE("limitPowerTransfer error %s", ret.getDescription().c_str());
-
-    status = getPortStatusHelper(currentPortStatus, mContaminantStatusPath);
-    ret = mCallback->notifyPortStatusChange(currentPortStatus,
-          status);
-    if (!ret.isOk())
-      ALOGE("queryPortStatus error %s", ret.getDescription().c_str());
+  callback = currentCallback();
+  if (callback && in_transactionId >= 0) {
+    mDispatcher.post(callback, "notifyLimitPowerTransferStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyLimitPowerTransferStatus(in_portName, in_limit, status,
+                                                    in_transactionId);
+        });
+
+    queuePortStatus(callback);
   } else {
     ALOGE("Not notifying the userspace. Callback is not set");
   }
@@ -1139,8 +1661,25 @@ ScopedAStatus Usb::limitPowerTransfer(const std::string& in_portName, bool in_li
   return ScopedAStatus::ok();
 }
 
+void Usb::finishResetUsbPort(const std::shared_ptr<IUsbCallback> &callback,
+    const std::string &dwcDriver, const std::string &mode, const std::string &portName,
+    int64_t transactionId) {
+  Status status = Status::SUCCESS;
+
+  if (!WriteStringToFile(mode.c_str(), dwcDriver + "mode"))
+    status = Status::ERROR;
+
+  if (callback) {
+    mDispatcher.post(callback, "notifyResetUsbPortStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyResetUsbPortStatus(portName, status, transactionId);
+        });
+  } else {
+    ALOGE("Not notifying the userspace. Callback is not set");
+  }
+}
+
 ScopedAStatus Usb::resetUsbPort(const std::string& in_portName, int64_t in_transactionId) {
-  std::scoped_lock lock(mLock);
   aidl::android::hardware::usb::Status status = Status::SUCCESS;
   std::string dwcDriver = "";
   std::string mode;
@@ -1148,7 +1687,7 @@ ScopedAStatus Usb::resetUsbPort(const std::string& in_portName, int64_t in_trans
 
   ALOGE("resetUsbPort %s", in_portName.c_str());
 
-  getUsbControllerPath(dwcDriver);
+  dwcDriver = mControllers.primaryPath();
   if (dwcDriver == "") {
     ALOGE("resetUsbPort unable to find dwc device");
     status = Status::ERROR;
@@ -1173,6 +1712,18 @@ ScopedAStatus Usb::resetUsbPort(const std::string& in_portName, int64_t in_trans
     goto out;
   }
 
+  // Restore the mode from the worker's timer queue rather than holding
+  // a binder thread for the whole disconnect. The caller is answered even
+  // if the callback is cleared meanwhile.
+  if (runOnWorker([this, callback = currentCallback(), dwcDriver, mode, in_portName,
+                   in_transactionId] {
+        runAfter(std::chrono::milliseconds(300),
+            [this, callback, dwcDriver, mode, in_portName, in_transactionId] {
+              finishResetUsbPort(callback, dwcDriver, mode, in_portName, in_transactionId);
+            });
+      }))
+    return ScopedAStatus::ok();
+
   std::this_thread::sleep_for(std::chrono::milliseconds(300));
   ret = WriteStringToFile(mode.c_str(), dwcDriver + "mode");
   if (!ret) {
@@ -1181,11 +1732,12 @@ ScopedAStatus Usb::resetUsbPort(const std::string& in_portName, int64_t in_trans
   }
 
 out:
-  if (mCallback) {
-    ScopedAStatus stat = mCallback->notifyResetUsbPortStatus(in_portName,
-        status, in_transactionId);
-    if (!stat.isOk())
-      ALOGE("notifyResetUsbPortStatus error %s", stat.getDescription().c_str());
+  std::shared_ptr<IUsbCallback> callback = currentCallback();
+  if (callback) {
+    mDispatcher.post(callback, "notifyResetUsbPortStatus",
+        [=](const std::shared_ptr<IUsbCallback> &cb) {
+          return cb->notifyResetUsbPortStatus(in_portName, status, in_transactionId);
+        });
   } else {
     ALOGE("Not notifying the userspace. Callback is not set");
   }
@@ -1193,6 +1745,86 @@ out:
   return ScopedAStatus::ok();
 }
 
+/*
+ * dumpsys android.hardware.usb.IUsb/default. Reads the published port state
+ * and counters the worker and dispatcher keep without locking.
+ */
+binder_status_t Usb::dump(int fd, const char** args, uint32_t numArgs) {
+  std::shared_ptr<const PortStateSnapshot> snapshot = portState();
+  SysfsStats &sysfs = SysfsAttr::stats();
+  std::string out;
+
+  if (snapshot) {
+    StringAppendF(&out, "Ports: snapshot %llu, published %lldms ago\n",
+                  (unsigned long long)snapshot->generation,
+                  (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - snapshot->published).count());
+    for (auto & [portName, port] : snapshot->ports)
+      StringAppendF(&out, "  %s: connected %d, %s, %s, mode %s, role swap %d, "
+                    "contaminant %s, %s\n",
+                    portName.c_str(), port.connected, toString(port.powerRole).c_str(),
+                    toString(port.dataRole).c_str(), toString(currentModeHelper(port)).c_str(),
+                    port.canSwitchRole, !port.contaminantSupported ? "not supported" :
+                    port.contaminantPresent ? "present" : "absent",
+                    toString(port.status).c_str());
+  } else {
+    out += "Ports: not published\n";
+  }
+  out += "  publish " + mPublishUs.toString("us") + "\n";
+  StringAppendF(&out, "  contaminant detected %llu times, cleared %llu times\n",
+                (unsigned long long)mContaminantDetected,
+                (unsigned long long)mContaminantCleared);
+  StringAppendF(&out, "  data disabled %d, power transfer limited %d\n", usbDataDisabled.load(),
+                limitedPower.load());
+  out += "setCallback lock hold " + mLockHoldUs.toString("us") + "\n";
+
+  StringAppendF(&out, "Worker: %llu wakeups, %llu for tasks, %llu for timers\n",
+                (unsigned long long)mWorkerStats.wakeups,
+                (unsigned long long)mWorkerStats.taskWakeups,
+                (unsigned long long)mWorkerStats.timerWakeups);
+  out += "  busy " + mWorkerStats.busyUs.toString("us") + "\n";
+  StringAppendF(&out, "  timers fired %llu, max lateness %uus\n",
+                (unsigned long long)mTimerQueue.fired(), mTimerQueue.maxLatenessUs());
+
+  StringAppendF(&out, "Uevents: %llu in %llu wakeups, batch last %u max %u, "
+                "max queued %uus, max handler %uus\n",
+                (unsigned long long)mUeventStats.messages,
+                (unsigned long long)mUeventStats.wakeups, mUeventStats.lastBatch.load(),
+                mUeventStats.maxBatch.load(), mUeventStats.maxQueueUs.load(),
+                mUeventStats.maxHandleUs.load());
+  for (size_t type = 0; type < kUeventTypeCount; type++) {
+    if (!mUeventStats.count[type])
+      continue;
+
+    StringAppendF(&out, "  %s: %llu\n", ueventTypeToString(static_cast<UeventType>(type)),
+                  (unsigned long long)mUeventStats.count[type]);
+    out += "    parse " + mUeventStats.parseNs[type].toString("ns") + "\n";
+    out += "    handle " + mUeventStats.handleUs[type].toString("us") + "\n";
+  }
+
+  StringAppendF(&out, "Role switches: %llu succeeded, %llu failed, %llu reverted to drp\n",
+                (unsigned long long)mRoleSwitchStats.succeeded,
+                (unsigned long long)mRoleSwitchStats.failed,
+                (unsigned long long)mRoleSwitchStats.reverted);
+  out += "  duration " + mRoleSwitchStats.durationMs.toString("ms") + "\n";
+
+  StringAppendF(&out, "Sysfs: %llu opens, %llu reads\n", (unsigned long long)sysfs.opens,
+                (unsigned long long)sysfs.reads);
+
+  StringAppendF(&out, "Autosuspend scan: %u devices, %u slices, total %lluus%s\n",
+                mScanStats.devices.load(), mScanStats.slices.load(),
+                (unsigned long long)mScanStats.totalUs,
+                mScanStats.totalUs || !mScanStats.slices ? "" : " (running)");
+  out += "  per device " + mScanStats.deviceUs.toString("us") + "\n";
+
+  StringAppendF(&out, "Controllers: %llu scans\n", (unsigned long long)mControllers.scans());
+  out += mControllers.dump();
+
+  ::android::base::WriteStringToFd(out, fd);
+  mDispatcher.dump(fd);
+  return STATUS_OK;
+}
+
 }  // namespace usb
 }  // namespace hardware
 }  // namespace android
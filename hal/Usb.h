@@ -26,11 +26,23 @@
 
 #include <aidl/android/hardware/usb/BnUsb.h>
 #include <aidl/android/hardware/usb/BnUsbCallback.h>
-#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <utils/Log.h>
 #include <android-base/unique_fd.h>
+#include <atomic>
+#include <map>
+#include <memory>
+
+#include "UsbCallbackDispatcher.h"
+#include "UsbControllers.h"
+#include "UsbStats.h"
+#include "UsbSysfs.h"
+#include "UsbTimerQueue.h"
+#include "UsbUevent.h"
 
 namespace aidl {
 namespace android {
@@ -43,6 +55,135 @@ using ::android::sp;
 using ::android::base::unique_fd;
 using ::ndk::ScopedAStatus;
 
+// Uevent worker statistics, updated only by the worker thread
+struct UeventStats {
+    // epoll wakeups with the uevent socket readable
+    std::atomic<uint64_t> wakeups{0};
+    // uevent messages handled across all wakeups
+    std::atomic<uint64_t> messages{0};
+    // messages handled by the most recent and the busiest wakeup
+    std::atomic<uint32_t> lastBatch{0};
+    std::atomic<uint32_t> maxBatch{0};
+    // Worst time a message waited in its batch behind the ones handled before it
+    std::atomic<uint32_t> maxQueueUs{0};
+    // Slowest single message handler
+    std::atomic<uint32_t> maxHandleUs{0};
+    // Messages, classifyUevent() time and handler time per UeventType
+    std::array<std::atomic<uint64_t>, kUeventTypeCount> count = {};
+    std::array<LatencyHistogram, kUeventTypeCount> parseNs;
+    std::array<LatencyHistogram, kUeventTypeCount> handleUs;
+};
+
+// Worker epoll loop statistics, updated only by the worker thread
+struct WorkerStats {
+    // epoll_wait() returns, whatever woke it up
+    std::atomic<uint64_t> wakeups{0};
+    // Wakeups for posted tasks and for expired timers
+    std::atomic<uint64_t> taskWakeups{0};
+    std::atomic<uint64_t> timerWakeups{0};
+    // Time from epoll_wait() returning to the next call
+    LatencyHistogram busyUs;
+};
+
+// Autosuspend scan of the USB devices present when the worker started,
+// updated only by the worker thread
+struct AutosuspendScanStats {
+    std::atomic<uint32_t> devices{0};
+    // Worker wakeups the scan was spread over
+    std::atomic<uint32_t> slices{0};
+    // From the start of the scan to the last device, 0 while it runs
+    std::atomic<uint64_t> totalUs{0};
+    LatencyHistogram deviceUs;
+};
+
+// Outcomes of switchRole() requests, updated only by the worker thread
+struct RoleSwitchStats {
+    std::atomic<uint64_t> succeeded{0};
+    // Failed without changing the port mode
+    std::atomic<uint64_t> failed{0};
+    // Partner did not come back and the port was put back to DRP
+    std::atomic<uint64_t> reverted{0};
+    // From switchRole() to the result being notified
+    LatencyHistogram durationMs;
+};
+
+// Cached view of /sys/class/typec/<port>, refreshed from typec uevents
+struct TypecPortState {
+    // <port>-partner is present
+    bool connected = false;
+    PortPowerRole powerRole = PortPowerRole::NONE;
+    PortDataRole dataRole = PortDataRole::NONE;
+    // AUDIO_ACCESSORY/DEBUG_ACCESSORY from partner accessory_mode, else NONE
+    PortMode accessoryMode = PortMode::NONE;
+    // Partner supports USB PD, so power and data roles can be swapped
+    bool canSwitchRole = false;
+    // A moisture sensor covers this port, and its last reading
+    bool contaminantSupported = false;
+    bool contaminantPresent = false;
+    // Result of the last sysfs refresh of this port
+    Status status = Status::SUCCESS;
+};
+
+/*
+ * Port state as last published by the uevent worker. A snapshot is never
+ * modified once published; the worker swaps in a new one, so readers on
+ * any thread use it without taking a lock.
+ */
+struct PortStateSnapshot {
+    std::map<std::string, TypecPortState> ports;
+    // Counts publications, for dump()
+    uint64_t generation = 0;
+    std::chrono::steady_clock::time_point published;
+};
+
+// Progress of a switchRole() request on a port
+enum class RoleSwitchState {
+    // Queued behind an earlier request on the same port
+    REQUESTED,
+    // New role written to sysfs
+    WRITTEN,
+    // port_type written, waiting for the partner to come back
+    AWAITING_PARTNER,
+    // Request completed, successfully or not
+    SETTLED,
+    // Partner did not come back, port switched back to DRP
+    REVERTED,
+};
+
+// Sysfs attributes of /sys/class/typec/<port> read for every PortStatus
+struct TypecPortAttrs {
+    explicit TypecPortAttrs(const std::string &portName);
+
+    SysfsAttr powerRole;
+    SysfsAttr dataRole;
+    // <port>-partner attributes, reopened as partners come and go
+    SysfsAttr accessoryMode;
+    SysfsAttr supportsPd;
+    // Moisture sensor of the port, no path if it has none
+    SysfsAttr contaminant;
+};
+
+// power_operation_mode of a Type-C port, tracked by the uevent worker
+struct TypecPortPower {
+    explicit TypecPortPower(const std::string &portName);
+
+    SysfsAttr opModeAttr;
+    // Last value read from opModeAttr
+    std::string opMode;
+};
+
+struct RoleSwitchRequest {
+    PortRole role;
+    int64_t transactionId;
+    RoleSwitchState state;
+    std::chrono::steady_clock::time_point requested;
+    // Partner timeout timer while AWAITING_PARTNER, 0 otherwise
+    uint64_t timer;
+    // Registered when the request was made; told the outcome even if the
+    // callback is cleared meanwhile
+    std::shared_ptr<IUsbCallback> callback;
+};
+
 struct Usb : public BnUsb {
     Usb();
 
@@ -60,43 +201,118 @@ struct Usb : public BnUsb {
             int64_t in_transactionId) override;
     ScopedAStatus resetUsbPort(const std::string& in_portName,
             int64_t in_transactionId) override;
-    Status getPortStatusHelper(std::vector<PortStatus> &currentPortStatus,
-            const std::string &contaminantStatusPath);
+    binder_status_t dump(int fd, const char** args, uint32_t numArgs) override;
+    Status getPortStatusHelper(std::vector<PortStatus> &currentPortStatus);
+    std::shared_ptr<const PortStateSnapshot> portState() const {
+        return std::atomic_load(&mPortSnapshot);
+    }
+    std::shared_ptr<IUsbCallback> currentCallback() const {
+        return std::atomic_load(&mCallback);
+    }
+    void syncPortState();
+    void updatePortState(const Uevent &event);
+    bool refreshContaminantState();
+    void updatePowerOpMode(const std::string &portName, bool removed);
+    bool isPortConnected(const std::string &portName);
+    void queuePortStatus(const std::shared_ptr<IUsbCallback> &callback, bool always = false);
+    bool runOnWorker(std::function<void()> task);
+    // Run task on the worker after delay; only callable from the worker
+    uint64_t runAfter(std::chrono::milliseconds delay, std::function<void()> task);
+    bool roleSwitchActive(const std::string &portName);
+    void roleSwitchPartnerAdded(const std::string &portName);
 
+    // Delivers notifications to mCallback off the calling thread
+    CallbackDispatcher mDispatcher;
+    // Read through currentCallback(), swapped atomically by setCallback()
     std::shared_ptr<IUsbCallback> mCallback;
-    // Protects mCallback variable
+    // Serialises setCallback() and the worker thread start and stop
     std::mutex mLock;
-    // Protects roleSwitch operation
-    std::mutex mRoleSwitchLock;
-    // Threads waiting for the partner to come back wait here
-    std::condition_variable mPartnerCV;
-    // lock protecting mPartnerCV
-    std::mutex mPartnerLock;
-    // Variable to signal partner coming back online after type switch
-    bool mPartnerUp;
-    // Variable to indicate presence or absence or contaminant
-    bool mContaminantPresence;
-    // Variable to indicate presence or absence of wakeup node
+    // mLock hold times, recorded under the lock
+    LatencyHistogram mLockHoldUs;
+    // Driver directories of the USB controllers
+    ControllerRegistry mControllers;
+    // Variable to indicate presence or absence of wakeup node; worker only
     bool mIgnoreWakeup;
-    // Configuration descriptor for MaxPower
-    std::string mMaxPower;
-    // Configuration descriptor for bmAttributes
-    std::string mAttributes;
-    // Current power operation mode
-    std::string mPowerOpMode;
-    // Path to get the status of contaminant presence
+    // Path to get the status of contaminant presence; worker only
     std::string mContaminantStatusPath;
     // USB bus reset recovery active
     int usbResetRecov;
     // USB data disabled
-    bool usbDataDisabled;
+    std::atomic<bool> usbDataDisabled{false};
     // Limit power transfer
-    bool limitedPower;
+    std::atomic<bool> limitedPower{false};
+    // Batch sizes, queueing delay and per type counts, parse and handler
+    // times of the uevents handled by the worker
+    UeventStats mUeventStats;
+    // Contaminant presence changes seen on POWER_SUPPLY uevents
+    std::atomic<uint64_t> mContaminantDetected;
+    std::atomic<uint64_t> mContaminantCleared;
 
   private:
+    // Cached Type-C port state, keyed by port name. Worker only; other
+    // threads read the copy published in mPortSnapshot.
+    std::map<std::string, TypecPortState> mPortState;
+    // mPortState must be rebuilt from sysfs before its next use
+    bool mPortStateStale;
+    // Open handles on the attributes behind mPortState
+    std::map<std::string, TypecPortAttrs> mPortAttrs;
+    void resyncPortState();
+    void publishPortState();
+    // Accessed only through std::atomic_load() and std::atomic_store()
+    std::shared_ptr<const PortStateSnapshot> mPortSnapshot;
+    // Time the worker takes to copy and publish a snapshot
+    LatencyHistogram mPublishUs;
+
+    // Pending role switches per port, front entry in progress. Worker only.
+    std::map<std::string, std::deque<RoleSwitchRequest>> mRoleSwitches;
+    void startRoleSwitch(const std::string &portName);
+    void finishRoleSwitch(const std::string &portName, bool roleSwitch);
+    void roleSwitchTimedOut(const std::string &portName);
+    void abortRoleSwitches();
+    void notifyRoleSwitch(const std::string &portName, const RoleSwitchRequest &req,
+                          Status status);
+    RoleSwitchStats mRoleSwitchStats;
+
+    // Power operation mode per port. Worker only.
+    std::map<std::string, TypecPortPower> mPortPower;
+    // Port whose USB PD contract zeroed the gadget's MaxPower, if any, and
+    // the configuration descriptor values to restore when it ends
+    std::string mGadgetPowerPort;
+    std::string mMaxPower;
+    std::string mAttributes;
+
+    void finishResetUsbPort(const std::shared_ptr<IUsbCallback> &callback,
+                            const std::string &dwcDriver, const std::string &mode,
+                            const std::string &portName, int64_t transactionId);
+
+    // Work posted to the uevent worker, signalled through mTaskFd
+    std::deque<std::function<void()>> mTasks;
+    unique_fd mTaskFd;
+    // Worker is accepting tasks
+    bool mWorkerRunning;
+    // Protects mTasks and mWorkerRunning
+    std::mutex mTaskLock;
+    void runTasks();
+
+    // Deferred work of the worker, polled from its epoll loop
+    TimerQueue mTimerQueue;
+
+    // Worker thread and its stop eventfd, both owned by setCallback()
+    // under mLock
     std::thread mPoll;
     unique_fd mEventFd;
-    bool switchMode(const std::string &portName, const PortRole &newRole);
+    void stopWorker();
+    // Reusable receive ring for the uevent socket, owned by the worker
+    std::unique_ptr<UeventBatchReceiver> mUeventRx;
+    WorkerStats mWorkerStats;
+
+    // Devices the autosuspend scan has yet to visit. Worker only.
+    std::deque<std::string> mScanPending;
+    std::chrono::steady_clock::time_point mScanStart;
+    AutosuspendScanStats mScanStats;
+    void startAutosuspendScan();
+    void autosuspendScanSlice();
+    void uevent_drain(const unique_fd &uevent_fd);
     void uevent_work();
 };
 
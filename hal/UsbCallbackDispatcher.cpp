@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG "android.hardware.usb-service.qti"
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <utils/Log.h>
+
+#include "UsbCallbackDispatcher.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::StringPrintf;
+
+CallbackDispatcher::CallbackDispatcher(size_t capacity)
+    : mCapacity(capacity), mStopping(false), mMaxDepth(0), mDelivered(0), mCoalesced(0),
+      mSuppressed(0), mFailed(0), mOverflows(0), mLastRetval(Status::SUCCESS) {
+  mThread = std::thread(&CallbackDispatcher::work, this);
+}
+
+CallbackDispatcher::~CallbackDispatcher() {
+  {
+    std::scoped_lock lock(mLock);
+    mStopping = true;
+  }
+  mQueuedCV.notify_one();
+  mThread.join();
+}
+
+void CallbackDispatcher::postPortStatus(const std::shared_ptr<IUsbCallback> &callback,
+    std::vector<PortStatus> currentPortStatus, Status retval, bool always) {
+  Item item = { callback, "notifyPortStatusChange", true, std::move(currentPortStatus),
+                retval, always, nullptr };
+
+  enqueue(std::move(item));
+}
+
+void CallbackDispatcher::post(const std::shared_ptr<IUsbCallback> &callback,
+    const char *name, Notify notify) {
+  Item item = { callback, name, false, {}, Status::SUCCESS, false, std::move(notify) };
+
+  enqueue(std::move(item));
+}
+
+void CallbackDispatcher::enqueue(Item item) {
+  std::unique_lock lock(mLock);
+
+  item.queued = std::chrono::steady_clock::now();
+  if (item.portStatus) {
+    if (!mQueue.empty() && mQueue.back().portStatus &&
+        mQueue.back().callback == item.callback) {
+      item.always |= mQueue.back().always;
+      mQueue.back() = std::move(item);
+      mCoalesced++;
+      return;
+    }
+
+    /*
+     * On a full queue the latest pending snapshot takes the new state in
+     * place, so that it is still delivered ahead of the notifications
+     * queued after it, e.g. the notifyQueryPortStatus() it answers.
+     */
+    if (mQueue.size() >= mCapacity) {
+      for (auto it = mQueue.rbegin(); it != mQueue.rend(); ++it) {
+        if (it->portStatus && it->callback == item.callback) {
+          item.always |= it->always;
+          item.queued = it->queued;
+          *it = std::move(item);
+          mCoalesced++;
+          return;
+        }
+      }
+    }
+  }
+
+  /*
+   * Nothing waits for space: the worker must not stall behind a slow
+   * client, and dropping a transaction result would leave the framework
+   * waiting for it. The queue may grow past its capacity instead.
+   */
+  if (mQueue.size() >= mCapacity) {
+    if (!mOverflows++)
+      ALOGE("callback queue full at %zu, %s delivery is behind", mQueue.size(), item.name);
+  }
+
+  mQueue.push_back(std::move(item));
+  if (mQueue.size() > mMaxDepth)
+    mMaxDepth = mQueue.size();
+
+  lock.unlock();
+  mQueuedCV.notify_one();
+}
+
+size_t CallbackDispatcher::depth() {
+  std::scoped_lock lock(mLock);
+
+  return mQueue.size();
+}
+
+// Names of the fields that differ between two snapshots, for logging
+static std::string portStatusDiff(const std::vector<PortStatus> &last,
+                                  const std::vector<PortStatus> &current) {
+  std::string diff;
+
+  if (last.size() != current.size())
+    return "ports";
+
+  for (size_t i = 0; i < current.size(); i++) {
+    const PortStatus &a = last[i], &b = current[i];
+    std::string fields;
+
+    if (a == b)
+      continue;
+
+    auto check = [&](bool changed, const char *name) {
+      if (changed)
+        fields += std::string(fields.empty() ? "" : ",") + name;
+    };
+    check(a.portName != b.portName, "portName");
+    check(a.currentDataRole != b.currentDataRole, "dataRole");
+    check(a.currentPowerRole != b.currentPowerRole, "powerRole");
+    check(a.currentMode != b.currentMode, "mode");
+    check(a.canChangeMode != b.canChangeMode || a.canChangeDataRole != b.canChangeDataRole ||
+          a.canChangePowerRole != b.canChangePowerRole, "canChange");
+    check(a.contaminantProtectionStatus != b.contaminantProtectionStatus ||
+          a.contaminantDetectionStatus != b.contaminantDetectionStatus ||
+          a.supportedContaminantProtectionModes != b.supportedContaminantProtectionModes,
+          "contaminant");
+    check(a.usbDataStatus != b.usbDataStatus, "usbData");
+    check(a.powerTransferLimited != b.powerTransferLimited, "powerTransferLimited");
+
+    diff += std::string(diff.empty() ? "" : " ") + b.portName + ":" +
+            (fields.empty() ? "other" : fields);
+  }
+
+  return diff;
+}
+
+/*
+ * Whether a snapshot tells the callback anything new. Nothing is
+ * remembered across a callback change or a failed delivery.
+ */
+bool CallbackDispatcher::portStatusChanged(const Item &item) {
+  if (item.always || item.callback != mLastCallback.lock() || item.retval != mLastRetval)
+    return true;
+
+  if (item.currentPortStatus == mLastPortStatus)
+    return false;
+
+  ALOGI("port status changed: %s",
+        portStatusDiff(mLastPortStatus, item.currentPortStatus).c_str());
+  return true;
+}
+
+void CallbackDispatcher::dump(int fd) {
+  std::string out = StringPrintf(
+      "Callbacks: delivered %llu, failed %llu, coalesced %llu, unchanged %llu, "
+      "queued %zu (max %zu, over capacity %llu)\n",
+      (unsigned long long)mDelivered, (unsigned long long)mFailed,
+      (unsigned long long)mCoalesced, (unsigned long long)mSuppressed, depth(), maxDepth(),
+      (unsigned long long)mOverflows);
+
+  out += "  queue wait " + mWaitUs.toString("us") + "\n";
+  out += "  binder call " + mCallUs.toString("us") + "\n";
+  ::android::base::WriteStringToFd(out, fd);
+}
+
+void CallbackDispatcher::work() {
+  while (true) {
+    std::unique_lock lock(mLock);
+
+    mQueuedCV.wait(lock, [this] { return !mQueue.empty() || mStopping; });
+    if (mQueue.empty())
+      break;
+
+    Item item = std::move(mQueue.front());
+    mQueue.pop_front();
+    lock.unlock();
+
+    if (item.portStatus && !portStatusChanged(item)) {
+      mSuppressed++;
+      continue;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ScopedAStatus ret = item.portStatus ?
+        item.callback->notifyPortStatusChange(item.currentPortStatus, item.retval) :
+        item.notify(item.callback);
+    auto end = std::chrono::steady_clock::now();
+
+    mWaitUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        start - item.queued).count());
+    mCallUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start).count());
+
+    if (!ret.isOk()) {
+      ALOGE("%s error %s", item.name, ret.getDescription().c_str());
+      mFailed++;
+      if (item.portStatus)
+        mLastCallback.reset();
+    } else if (item.portStatus) {
+      mLastCallback = item.callback;
+      mLastPortStatus = std::move(item.currentPortStatus);
+      mLastRetval = item.retval;
+    }
+
+    mDelivered++;
+  }
+
+  ALOGI("callback dispatcher exiting");
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBCALLBACKDISPATCHER_H
+#define ANDROID_HARDWARE_USB_QTI_USBCALLBACKDISPATCHER_H
+
+#include <aidl/android/hardware/usb/BnUsbCallback.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "UsbStats.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::ndk::ScopedAStatus;
+
+/*
+ * Delivers IUsbCallback notifications from a dedicated thread so that the
+ * uevent worker and binder threads never block on system_server.
+ *
+ * Notifications are delivered in the order they were queued. A port status
+ * snapshot queued right behind another one for the same callback replaces
+ * it, since only the latest state is of interest, and a snapshot equal to
+ * the last one delivered to the callback is dropped. Posting never blocks.
+ */
+class CallbackDispatcher {
+ public:
+  typedef std::function<ScopedAStatus(const std::shared_ptr<IUsbCallback> &)> Notify;
+
+  explicit CallbackDispatcher(size_t capacity);
+  ~CallbackDispatcher();
+
+  // Queue notifyPortStatusChange(), coalescing with a pending snapshot.
+  // always delivers it even if nothing changed, e.g. to answer a query.
+  void postPortStatus(const std::shared_ptr<IUsbCallback> &callback,
+                      std::vector<PortStatus> currentPortStatus, Status retval,
+                      bool always = false);
+  // Queue a transaction specific notification; name is used for logging
+  void post(const std::shared_ptr<IUsbCallback> &callback, const char *name,
+            Notify notify);
+
+  size_t depth();
+  size_t maxDepth() const { return mMaxDepth; }
+  uint64_t delivered() const { return mDelivered; }
+  uint64_t coalesced() const { return mCoalesced; }
+  uint64_t suppressed() const { return mSuppressed; }
+
+  // Queue and delivery counters and latencies
+  void dump(int fd);
+
+ private:
+  struct Item {
+    std::shared_ptr<IUsbCallback> callback;
+    const char *name;
+    // Set for notifyPortStatusChange() snapshots, which may be coalesced
+    bool portStatus;
+    std::vector<PortStatus> currentPortStatus;
+    Status retval;
+    // Deliver the snapshot even if it did not change
+    bool always;
+    Notify notify;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  void enqueue(Item item);
+  void work();
+  bool portStatusChanged(const Item &item);
+
+  const size_t mCapacity;
+  std::deque<Item> mQueue;
+  std::mutex mLock;
+  // Signalled when an item is queued or on shutdown
+  std::condition_variable mQueuedCV;
+  bool mStopping;
+  std::thread mThread;
+
+  std::atomic<size_t> mMaxDepth;
+  std::atomic<uint64_t> mDelivered;
+  std::atomic<uint64_t> mCoalesced;
+  std::atomic<uint64_t> mSuppressed;
+  std::atomic<uint64_t> mFailed;
+  // Items queued while the queue was at capacity
+  std::atomic<uint64_t> mOverflows;
+  // Time from being queued to the binder call, and of the call itself
+  LatencyHistogram mWaitUs;
+  LatencyHistogram mCallUs;
+
+  // Last snapshot delivered and who to; dispatcher thread only
+  std::weak_ptr<IUsbCallback> mLastCallback;
+  std::vector<PortStatus> mLastPortStatus;
+  Status mLastRetval;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBCALLBACKDISPATCHER_H
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * Applies a sys.usb.config composition listed in usb_compositions.conf to
+ * the configfs gadget on targets without the gadget HAL
+ * (sys.usb.configfs=1), in place of one init action per composition.
+ *
+ * Run from init on every sys.usb.config change. Compositions with adb are
+ * only flagged in vendor.usb.compose.adb so that init starts adbd; init
+ * runs the tool again with --ffs-ready once adbd has set up functionfs.
+ * The tool reports the applied composition in vendor.usb.compose.state,
+ * which init copies to sys.usb.state. Compositions not in the table are
+ * left to the remaining init actions.
+ *
+ * usage: usb_compose [--ffs-ready] <sys.usb.config>
+ */
+
+#define LOG_TAG "usb_compose"
+
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "UsbCompositionTable.h"
+#include "UsbFunctions.h"
+#include "UsbSysfs.h"
+
+using ::aidl::android::hardware::usb::Composition;
+using ::aidl::android::hardware::usb::CompositionMap;
+using ::aidl::android::hardware::usb::CompositionTable;
+using ::aidl::android::hardware::usb::FunctionSet;
+using ::aidl::android::hardware::usb::fsPath;
+using ::aidl::android::hardware::usb::functionDirName;
+using ::aidl::android::hardware::usb::kFuncAdb;
+using ::aidl::android::hardware::usb::kFuncDiag;
+using ::aidl::android::hardware::usb::kFuncMtp;
+using ::aidl::android::hardware::usb::kFuncPtp;
+using ::aidl::android::hardware::usb::kFuncQdss;
+using ::aidl::android::hardware::usb::kFuncQdssDebug;
+using ::aidl::android::hardware::usb::readCompositionsConf;
+using ::android::base::GetBoolProperty;
+using ::android::base::GetProperty;
+using ::android::base::SetProperty;
+using ::android::base::StringPrintf;
+using ::android::base::unique_fd;
+
+#define GADGET_PATH "/config/usb_gadget/g1/"
+#define CONFIG_PATH GADGET_PATH "configs/b.1/"
+#define FUNCTIONS_PATH GADGET_PATH "functions/"
+#define COMPOSE_ADB_PROP "vendor.usb.compose.adb"
+#define COMPOSE_DEFER_PROP "vendor.usb.compose.defer"
+#define COMPOSE_STATE_PROP "vendor.usb.compose.state"
+
+namespace {
+
+/*
+ * Rewritten by init to rndis,<persist.vendor.usb.config.extra>[,adb] when
+ * the target has an rndis function driver, and handled by the platform's
+ * init.usb.configfs.rc otherwise
+ */
+const char *const kInitOwned[] = { "rndis", "rndis,adb" };
+
+// Bound on sys.usb.ffs.ready without adb, like the init actions they replace
+const char *const kWaitFfsReady[] = {
+  "diag,diag_mdm,qdss,qdss_mdm,serial_cdev,dpl,rmnet",
+  "rndis,diag,diag_mdm,qdss,qdss_mdm,serial_cdev,dpl",
+  "rndis,diag,qdss,serial_cdev,dpl",
+  "diag,diag_mdm,diag_mdm2,qdss,qdss_mdm,serial_cdev,dpl,rmnet",
+  "rndis,diag,diag_mdm,diag_mdm2,qdss,qdss_mdm,serial_cdev,dpl",
+};
+
+// Failed writes, logged together once every step has been tried
+struct Failures {
+  int count = 0;
+  std::string first;
+
+  void add(const std::string &path, int err) {
+    if (count++ < 8)
+      first += (first.empty() ? "" : ", ") + path + ": " + strerror(err);
+  }
+};
+
+void writeFile(const std::string &path, const std::string &value, Failures &failures) {
+  unique_fd fd(TEMP_FAILURE_RETRY(open(fsPath(path).c_str(), O_WRONLY | O_CLOEXEC)));
+
+  if (fd == -1 ||
+      TEMP_FAILURE_RETRY(write(fd.get(), value.data(), value.size())) != (ssize_t)value.size())
+    failures.add(path, errno);
+}
+
+void symlinkFile(const std::string &target, const std::string &path, Failures &failures) {
+  if (symlink(fsPath(target).c_str(), fsPath(path).c_str()))
+    failures.add(path, errno);
+}
+
+// Remove every function link of the configuration, whatever its name
+void unlinkFunctions() {
+  std::string configPath = fsPath(CONFIG_PATH);
+  DIR *dir = opendir(configPath.c_str());
+
+  if (!dir)
+    return;
+
+  while (struct dirent *entry = readdir(dir)) {
+    if (entry->d_type == DT_LNK)
+      unlinkat(dirfd(dir), entry->d_name, 0);
+  }
+  closedir(dir);
+}
+
+// sys.usb.config without the "none" placeholder of an unset config.extra
+bool parseConfig(const std::string &config, FunctionSet *key) {
+  std::string functions;
+
+  for (size_t pos = 0; pos <= config.size();) {
+    size_t comma = std::min(config.find(',', pos), config.size());
+    std::string function = config.substr(pos, comma - pos);
+
+    if (function != "none")
+      functions += (functions.empty() ? "" : ",") + function;
+    pos = comma + 1;
+  }
+
+  return FunctionSet::parse(functions, key);
+}
+
+// Same precedence as the gadget HAL: /odm and /product text overrides,
+// then the compiled /vendor table, then the /vendor text file
+bool lookupComposition(const FunctionSet &key, Composition *composition) {
+  CompositionMap overrides;
+  CompositionTable table;
+
+  readCompositionsConf(fsPath("/odm/etc/usb_compositions.conf"), overrides);
+  readCompositionsConf(fsPath("/product/etc/usb_compositions.conf"), overrides);
+
+  auto it = overrides.find(key);
+  if (it != overrides.end()) {
+    *composition = it->second;
+    return true;
+  }
+
+  if (table.open(fsPath("/vendor/etc/usb_compositions.bin"))) {
+    const Composition *found = table.find(key);
+
+    if (found)
+      *composition = *found;
+    return found;
+  }
+
+  readCompositionsConf(fsPath("/vendor/etc/usb_compositions.conf"), overrides);
+  it = overrides.find(key);
+  if (it == overrides.end())
+    return false;
+
+  *composition = it->second;
+  return true;
+}
+
+std::string functionDir(int id) {
+  // Targets without functionfs MTP still use the legacy function driver
+  if ((id == kFuncMtp || id == kFuncPtp) && !GetBoolProperty("vendor.usb.use_ffs_mtp", false))
+    return id == kFuncMtp ? "mtp.gs0" : "ptp.gs1";
+
+  return functionDirName(id, [](const char *name, const char *defaultValue) {
+    return GetProperty(name, defaultValue);
+  });
+}
+
+// The init actions only ever reported rndis[,adb] for rndis compositions
+std::string usbState(const std::string &config, bool adb) {
+  if (config.compare(0, 6, "rndis,"))
+    return config;
+
+  return adb ? "rndis,adb" : "rndis";
+}
+
+// Bound right away as the init actions did. That only works once the MTP
+// daemon has written its descriptors, which no_disconnect keeps across
+// sessions, so say when they are missing
+void checkFfsMtp(const Composition &composition) {
+  struct stat st;
+
+  if (!GetBoolProperty("vendor.usb.use_ffs_mtp", false))
+    return;
+
+  for (uint8_t id : composition.functions) {
+    const char *ep = id == kFuncMtp ? "/dev/usb-ffs/mtp/ep1" :
+        id == kFuncPtp ? "/dev/usb-ffs/ptp/ep1" : nullptr;
+
+    if (ep && stat(fsPath(ep).c_str(), &st))
+      ALOGI("%s not ready yet, bind may fail until the daemon sets it up", ep);
+  }
+}
+
+void applyComposition(const std::string &config, const Composition &composition) {
+  auto start = std::chrono::steady_clock::now();
+  Failures failures;
+  int link = 0;
+
+  writeFile(CONFIG_PATH "strings/0x409/configuration", composition.functions.toString(),
+            failures);
+  unlinkFunctions();
+
+  // As the gadget HAL does, and as every init stanza with these functions did
+  if (composition.functions.contains(kFuncAdb) || composition.functions.contains(kFuncMtp) ||
+      composition.functions.contains(kFuncPtp))
+    symlinkFile(GADGET_PATH "configs/b.1", GADGET_PATH "os_desc/b.1", failures);
+
+  writeFile(GADGET_PATH "idVendor", StringPrintf("0x%04x", composition.vid), failures);
+  writeFile(GADGET_PATH "idProduct", StringPrintf("0x%04x", composition.pid), failures);
+
+  // Set Diag PID for QC DLOAD mode
+  if (composition.vid == 0x05c6 && composition.functions[0] == kFuncDiag)
+    writeFile(FUNCTIONS_PATH "diag.diag/pid", StringPrintf("0x%04x", composition.pid), failures);
+
+  for (uint8_t id : composition.functions) {
+    std::string dir = functionDir(id);
+
+    if (id == kFuncQdss || id == kFuncQdssDebug)
+      writeFile(FUNCTIONS_PATH + dir + "/enable_debug_inface", id == kFuncQdssDebug ? "1" : "0",
+                failures);
+
+    symlinkFile(FUNCTIONS_PATH + dir, CONFIG_PATH "f" + std::to_string(++link), failures);
+  }
+
+  checkFfsMtp(composition);
+  writeFile(GADGET_PATH "UDC", GetProperty("sys.usb.controller", ""), failures);
+  SetProperty(COMPOSE_STATE_PROP,
+              usbState(config, composition.functions.contains(kFuncAdb)));
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  // Functions missing from the kernel fail here as they did under init
+  if (failures.count)
+    ALOGE("%s applied in %lld us, %d writes failed: %s%s", config.c_str(), (long long)elapsed,
+          failures.count, failures.first.c_str(), failures.count > 8 ? ", ..." : "");
+  else
+    ALOGI("%s applied in %lld us, vid 0x%04x pid 0x%04x", config.c_str(), (long long)elapsed,
+          composition.vid, composition.pid);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  bool ffsReady = argc == 3 && !strcmp(argv[1], "--ffs-ready");
+  Composition composition;
+  FunctionSet key;
+
+  if (argc != 2 && !ffsReady) {
+    fprintf(stderr, "usage: %s [--ffs-ready] <sys.usb.config>\n", argv[0]);
+    return 1;
+  }
+
+  std::string config = argv[argc - 1];
+  bool handled = parseConfig(config, &key) && lookupComposition(key, &composition);
+
+  for (const char *owned : kInitOwned) {
+    if (config == owned)
+      handled = false;
+  }
+
+  bool adb = handled && composition.functions.contains(kFuncAdb);
+  bool defer = adb;
+
+  for (const char *wait : kWaitFfsReady) {
+    if (handled && config == wait)
+      defer = true;
+  }
+
+  if (ffsReady) {
+    if (defer)
+      applyComposition(config, composition);
+    return 0;
+  }
+
+  // Cleared for every other composition, so that the next one with adb
+  // triggers init again
+  SetProperty(COMPOSE_ADB_PROP, adb ? "1" : "0");
+  SetProperty(COMPOSE_DEFER_PROP, defer ? "1" : "0");
+
+  if (handled && !defer)
+    applyComposition(config, composition);
+
+  return 0;
+}
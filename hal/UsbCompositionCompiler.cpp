@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * Host tool: compile usb_compositions.conf into the usb_compositions.bin
+ * table mmapped by the gadget HAL.
+ *
+ * usage: usb_compositions_compiler <usb_compositions.conf> <usb_compositions.bin>
+ */
+
+#include <android-base/file.h>
+#include <stdio.h>
+
+#include "UsbCompositionTable.h"
+
+using ::aidl::android::hardware::usb::buildCompositionTable;
+using ::aidl::android::hardware::usb::CompositionMap;
+using ::aidl::android::hardware::usb::readCompositionsConf;
+
+int main(int argc, char **argv) {
+  CompositionMap compositions;
+  std::string image, error;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <usb_compositions.conf> <usb_compositions.bin>\n", argv[0]);
+    return 1;
+  }
+
+  if (!readCompositionsConf(argv[1], compositions))
+    return 1;
+
+  if (compositions.empty()) {
+    fprintf(stderr, "%s: no compositions found\n", argv[1]);
+    return 1;
+  }
+
+  if (!buildCompositionTable(compositions, &image, &error)) {
+    fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+    return 1;
+  }
+
+  if (!::android::base::WriteStringToFile(image, argv[2])) {
+    fprintf(stderr, "%s: write failed\n", argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG "android.hardware.usb.gadget-service.qti"
+
+#include <android-base/unique_fd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utils/Log.h>
+#include <vector>
+
+#include "UsbCompositionTable.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+static bool parseId(const std::string &str, uint16_t *id) {
+  char *end;
+  unsigned long val = strtoul(str.c_str(), &end, 16);
+
+  if (str.empty() || *end != '\0' || val > UINT16_MAX)
+    return false;
+
+  *id = val;
+  return true;
+}
+
+bool readCompositionsConf(const std::string &fileName, CompositionMap &compositions) {
+  std::ifstream conf(fileName);
+  std::string line;
+  bool ok = true;
+
+  while (std::getline(conf, line)) {
+    std::string prop, vid, pid, order;
+    Composition composition;
+    FunctionSet key;
+    // Ignore comments in the file
+    auto pos = line.find('#');
+    if (pos != std::string::npos)
+      line.erase(pos);
+
+    std::stringstream words(line);
+
+    words >> prop >> vid >> pid >> order;
+    // If we get pid, we have the three minimum values needed. Or else we skip
+    if (pid.empty())
+      continue;
+
+    if (!FunctionSet::parse(prop, &key) ||
+        !FunctionSet::parse(order.empty() ? prop : order, &composition.functions) ||
+        !parseId(vid, &composition.vid) || !parseId(pid, &composition.pid)) {
+      ALOGE("%s: skipping invalid composition %s", fileName.c_str(), prop.c_str());
+      continue;
+    }
+
+    for (auto & [other, unused] : compositions) {
+      if (other.sameMembers(key) && other != key) {
+        ALOGE("%s: %s has the same functions as %s", fileName.c_str(), prop.c_str(),
+              other.toString().c_str());
+        ok = false;
+      }
+    }
+
+    compositions.insert_or_assign(key, composition);
+  }
+
+  return ok;
+}
+
+/*
+ * murmur3 finalizer of the key's function mask; keys are unique sets, so
+ * the mask alone identifies a composition
+ */
+uint32_t compositionHash(uint32_t mask, uint32_t seed) {
+  uint32_t hash = mask ^ (seed * 0x9e3779b9u);
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+bool buildCompositionTable(const CompositionMap &compositions, std::string *image,
+                           std::string *error) {
+  uint32_t slots = 1;
+
+  // at most half full, so that a collision free seed is quick to find
+  while (slots < 2 * compositions.size())
+    slots <<= 1;
+
+  std::vector<CompositionSlot> table;
+  uint32_t seed;
+  for (seed = 0; seed < 1000000; seed++) {
+    bool collision = false;
+
+    table.assign(slots, CompositionSlot());
+    for (auto & [key, composition] : compositions) {
+      CompositionSlot &slot = table[compositionHash(key.mask(), seed) & (slots - 1)];
+
+      if (!slot.key.empty()) {
+        collision = true;
+        break;
+      }
+      slot.key = key;
+      slot.composition = composition;
+    }
+
+    if (!collision)
+      break;
+  }
+
+  if (seed == 1000000) {
+    *error = "no perfect hash seed found";
+    return false;
+  }
+
+  CompositionTableHeader header = {};
+  memcpy(header.magic, kCompositionTableMagic, sizeof(header.magic));
+  header.version = kCompositionTableVersion;
+  header.slots = slots;
+  header.seed = seed;
+  header.count = compositions.size();
+
+  image->assign((const char *)&header, sizeof(header));
+  image->append((const char *)table.data(), slots * sizeof(CompositionSlot));
+  return true;
+}
+
+CompositionTable::~CompositionTable() {
+  if (mMap)
+    munmap(mMap, mMapSize);
+}
+
+bool CompositionTable::open(const std::string &path) {
+  ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  struct stat st;
+
+  if (fd == -1 || fstat(fd.get(), &st) == -1)
+    return false;
+
+  if ((size_t)st.st_size < sizeof(CompositionTableHeader)) {
+    ALOGE("%s: truncated", path.c_str());
+    return false;
+  }
+
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (map == MAP_FAILED) {
+    ALOGE("%s: mmap failed errno:%d", path.c_str(), errno);
+    return false;
+  }
+
+  auto *header = (const CompositionTableHeader *)map;
+  size_t slotsEnd = sizeof(*header) + (size_t)header->slots * sizeof(CompositionSlot);
+
+  if (memcmp(header->magic, kCompositionTableMagic, sizeof(header->magic)) ||
+      header->version != kCompositionTableVersion ||
+      header->slots == 0 || (header->slots & (header->slots - 1)) ||
+      slotsEnd != (size_t)st.st_size) {
+    ALOGE("%s: bad header", path.c_str());
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  mMap = map;
+  mMapSize = st.st_size;
+  mHeader = header;
+  mSlots = (const CompositionSlot *)((const char *)map + sizeof(*header));
+  return true;
+}
+
+const Composition *CompositionTable::find(const FunctionSet &key) const {
+  if (!isOpen())
+    return nullptr;
+
+  const CompositionSlot *slot =
+      &mSlots[compositionHash(key.mask(), mHeader->seed) & (mHeader->slots - 1)];
+
+  if (slot->key != key || !slot->composition.functions.valid())
+    return nullptr;
+
+  return &slot->composition;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
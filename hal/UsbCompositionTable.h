@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBCOMPOSITIONTABLE_H
+#define ANDROID_HARDWARE_USB_QTI_USBCOMPOSITIONTABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include "UsbFunctions.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+struct Composition {
+  uint16_t vid;
+  uint16_t pid;
+  // Link order: the "actual order" column if given, else the key itself
+  FunctionSet functions;
+};
+
+// Keyed by the composition as written in vendor.usb.config
+typedef std::unordered_map<FunctionSet, Composition, FunctionSetHash> CompositionMap;
+
+/*
+ * Parse a usb_compositions.conf, overriding entries already in
+ * compositions. Lines naming unknown functions are skipped. Returns false
+ * if two lines list the same functions in a different order, which the
+ * compiled table cannot represent.
+ */
+bool readCompositionsConf(const std::string &fileName, CompositionMap &compositions);
+
+/*
+ * usb_compositions.bin: usb_compositions.conf compiled at build time by
+ * usb_compositions_compiler, so that the gadget HAL can mmap it instead of
+ * parsing text at every start.
+ *
+ * Layout: header, slots[header.slots]. A composition lives in slot
+ * compositionHash(key.mask(), header.seed) & (header.slots - 1); the seed is
+ * chosen at build time so that no two keys share a slot.
+ */
+constexpr char kCompositionTableMagic[4] = { 'U', 'C', 'T', 'B' };
+constexpr uint32_t kCompositionTableVersion = 2;
+
+struct CompositionTableHeader {
+  char magic[4];
+  uint32_t version;
+  // power of two
+  uint32_t slots;
+  uint32_t seed;
+  uint32_t count;
+};
+
+struct CompositionSlot {
+  // empty for an unused slot
+  FunctionSet key;
+  Composition composition;
+};
+
+uint32_t compositionHash(uint32_t mask, uint32_t seed);
+
+// Build a table image from parsed compositions; used by the host compiler
+bool buildCompositionTable(const CompositionMap &compositions, std::string *image,
+                           std::string *error);
+
+class CompositionTable {
+ public:
+  CompositionTable() = default;
+  ~CompositionTable();
+  CompositionTable(const CompositionTable &) = delete;
+  CompositionTable &operator=(const CompositionTable &) = delete;
+
+  // mmap a compiled table; returns false if it is missing or malformed
+  bool open(const std::string &path);
+  bool isOpen() const { return mHeader != nullptr; }
+  size_t size() const { return isOpen() ? mHeader->count : 0; }
+
+  // nullptr if key is not in the table
+  const Composition *find(const FunctionSet &key) const;
+
+ private:
+  void *mMap = nullptr;
+  size_t mMapSize = 0;
+  const CompositionTableHeader *mHeader = nullptr;
+  const CompositionSlot *mSlots = nullptr;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBCOMPOSITIONTABLE_H
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG "android.hardware.usb-service.qti"
+
+#include <android-base/properties.h>
+#include <dirent.h>
+#include <string.h>
+#include <utils/Log.h>
+
+#include "UsbControllers.h"
+#include "UsbSysfs.h"
+
+#define USB_CONTROLLER_PROP "vendor.usb.controller"
+#define USB_CONTROLLER_SECONDARY_PROP "persist.vendor.usb.controller.secondary"
+#define DWC3_DRIVER_PATH "/sys/bus/platform/drivers/msm-dwc3/"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::GetProperty;
+
+ControllerRegistry::ControllerRegistry() : mValid(false), mScans(0) {
+}
+
+std::string ControllerRegistry::primaryPath() {
+  std::scoped_lock lock(mLock);
+
+  if (!mValid)
+    scanLocked();
+
+  auto it = mPaths.find(mPrimary);
+  return it == mPaths.end() ? "" : it->second;
+}
+
+std::string ControllerRegistry::path(const std::string &controllerName) {
+  std::scoped_lock lock(mLock);
+
+  if (!mValid)
+    scanLocked();
+
+  auto it = mPaths.find(controllerName);
+  if (it != mPaths.end())
+    return it->second;
+
+  // not one of the configured controllers; misses are not cached
+  return resolveLocked(controllerName);
+}
+
+void ControllerRegistry::scan() {
+  std::scoped_lock lock(mLock);
+
+  scanLocked();
+}
+
+void ControllerRegistry::invalidate() {
+  std::scoped_lock lock(mLock);
+
+  mValid = false;
+}
+
+/*
+ * The driver links are named after the glue device (a600000.ssusb) while
+ * the controller is named after its dwc3 child (a600000.dwc3), so match on
+ * the register address.
+ */
+std::string ControllerRegistry::resolveLocked(const std::string &controllerName) {
+  std::string address = controllerName.substr(0, controllerName.find('.'));
+
+  for (auto &entry : mEntries) {
+    if (strstr(entry.c_str(), address.c_str()))
+      return fsPath(DWC3_DRIVER_PATH) + entry + "/";
+  }
+
+  return "";
+}
+
+void ControllerRegistry::scanLocked() {
+  std::string secondary = GetProperty(USB_CONTROLLER_SECONDARY_PROP, "");
+  DIR *dir = opendir(fsPath(DWC3_DRIVER_PATH).c_str());
+
+  mPrimary = GetProperty(USB_CONTROLLER_PROP, "");
+  mEntries.clear();
+  mPaths.clear();
+  mScans++;
+
+  if (dir) {
+    while (struct dirent *entry = readdir(dir)) {
+      if (entry->d_type == DT_LNK)
+        mEntries.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+
+  for (const std::string &name : { mPrimary, secondary }) {
+    std::string path = name.empty() ? "" : resolveLocked(name);
+
+    if (!path.empty())
+      mPaths[name] = path;
+  }
+
+  // keep scanning until the primary controller is set and has probed
+  mValid = mPaths.count(mPrimary) != 0;
+  ALOGI("found %zu USB controllers%s", mPaths.size(),
+        mValid ? "" : mPrimary.empty() ? ", primary not set" : ", primary missing");
+}
+
+std::string ControllerRegistry::dump() {
+  std::scoped_lock lock(mLock);
+  std::string out;
+
+  for (auto & [name, path] : mPaths)
+    out += "  " + name + (name == mPrimary ? " (primary)" : "") + " -> " + path + "\n";
+
+  return out;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
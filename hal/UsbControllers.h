@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBCONTROLLERS_H
+#define ANDROID_HARDWARE_USB_QTI_USBCONTROLLERS_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Maps USB controller names, e.g. "a600000.dwc3" from vendor.usb.controller
+ * and persist.vendor.usb.controller.secondary, to their msm-dwc3 platform
+ * driver directory. The driver directory is scanned once and kept until
+ * invalidate(), which the uevent worker calls when a UDC or an msm-dwc3
+ * device comes or goes, so lookups normally cost no sysfs access.
+ *
+ * Thread safe.
+ */
+class ControllerRegistry {
+ public:
+  ControllerRegistry();
+
+  // Driver directory of the primary controller, with a trailing '/', or
+  // empty if it is not bound
+  std::string primaryPath();
+  // Same for any controller name
+  std::string path(const std::string &controllerName);
+
+  // Scan the driver directory now
+  void scan();
+  // Rescan on next lookup
+  void invalidate();
+
+  uint64_t scans() const { return mScans; }
+  // "name -> path" lines for dump()
+  std::string dump();
+
+ private:
+  void scanLocked();
+  std::string resolveLocked(const std::string &controllerName);
+
+  std::mutex mLock;
+  bool mValid;
+  std::string mPrimary;
+  // Links found in the driver directory at the last scan
+  std::vector<std::string> mEntries;
+  // Resolved controllers, keyed by name
+  std::map<std::string, std::string> mPaths;
+  std::atomic<uint64_t> mScans;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBCONTROLLERS_H
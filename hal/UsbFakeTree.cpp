@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * The fake sysfs/configfs tree built by usb_fake_tree and the benchmarks.
+ * See UsbFakeTree.h.
+ */
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "UsbFakeTree.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::StringPrintf;
+using ::android::base::WriteStringToFile;
+
+namespace {
+
+const char *const kGlue = "/sys/devices/platform/soc/a600000.ssusb";
+const char *const kDwc3 = "/sys/devices/platform/soc/a600000.ssusb/a600000.dwc3";
+const char *const kRootHub =
+    "/sys/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1";
+const char *const kTypec = "/sys/devices/platform/soc/soc:qcom,pmic_glink/typec";
+
+// As created by usb_gadget_provision
+const char *const kFunctionDirs[] = {
+  "mass_storage.0", "mtp.gs0", "ptp.gs1", "accessory.gs2", "audio_source.gs3", "midi.gs5",
+  "ffs.adb", "ffs.diag", "ffs.diag_mdm", "ffs.diag_mdm2", "ffs.mtp", "ffs.ptp",
+  "diag.diag", "diag.diag_mdm", "diag.diag_mdm2", "cser.dun.0", "cser.nmea.1", "cser.dun.2",
+  "gsi.rmnet", "gsi.rndis", "gsi.dpl", "qdss.qdss", "qdss.qdss_mdm", "qdss.qdss_sw",
+  "rndis_bam.rndis", "rndis.rndis", "rmnet_bam.rmnet", "rmnet_bam.dpl",
+  "rmnet_bam.rmnet_bam_dmux", "rmnet_bam.dpl_bam_dmux", "ncm.gs6", "ccid.ccid", "uac2.0",
+  "uvc.0",
+};
+
+// Audio, HID, mass storage: only audio allows autosuspend
+const char *const kInterfaceClasses[] = { "01", "03", "08" };
+
+std::string root;
+int failures;
+
+void makeDirs(const std::string &path) {
+  std::string full = root + path;
+
+  for (size_t pos = full.find('/', 1);; pos = full.find('/', pos + 1)) {
+    std::string dir = full.substr(0, pos);
+
+    if (mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+      fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+      failures++;
+      return;
+    }
+    if (pos == std::string::npos)
+      return;
+  }
+}
+
+void writeAttr(const std::string &path, const std::string &value) {
+  makeDirs(path.substr(0, path.rfind('/')));
+
+  if (!WriteStringToFile(value + "\n", root + path)) {
+    fprintf(stderr, "%s: write failed\n", (root + path).c_str());
+    failures++;
+  }
+}
+
+// path is a link to target, both absolute in the fake tree
+void linkTo(const std::string &target, const std::string &path) {
+  makeDirs(path.substr(0, path.rfind('/')));
+  unlink((root + path).c_str());
+
+  if (symlink((root + target).c_str(), (root + path).c_str())) {
+    fprintf(stderr, "%s: %s\n", (root + path).c_str(), strerror(errno));
+    failures++;
+  }
+}
+
+void buildController() {
+  writeAttr(std::string(kGlue) + "/mode", "peripheral");
+  writeAttr(std::string(kGlue) + "/dynamic_disable", "0");
+  writeAttr(std::string(kGlue) + "/power/wakeup", "disabled");
+  makeDirs(std::string(kDwc3) + "/udc/a600000.dwc3");
+  writeAttr(std::string(kDwc3) + "/udc/a600000.dwc3/current_speed", "UNKNOWN");
+  writeAttr(std::string(kDwc3) + "/udc/a600000.dwc3/state", "not attached");
+
+  linkTo(kGlue, "/sys/bus/platform/drivers/msm-dwc3/a600000.ssusb");
+  linkTo(kGlue, "/sys/bus/platform/devices/a600000.ssusb");
+  linkTo(kDwc3, "/sys/bus/platform/devices/a600000.dwc3");
+  linkTo(std::string(kDwc3) + "/udc/a600000.dwc3", "/sys/class/udc/a600000.dwc3");
+
+  writeAttr("/sys/class/power_supply/usb/moisture_detected", "0");
+  writeAttr("/sys/class/qcom-battery/restrict_cur", "0");
+  writeAttr("/sys/class/qcom-battery/restrict_chg", "0");
+}
+
+void buildPorts(int ports) {
+  for (int i = 0; i < ports; i++) {
+    std::string port = StringPrintf("port%d", i);
+    std::string dir = std::string(kTypec) + "/" + port;
+    std::string partner = dir + "/" + port + "-partner";
+
+    writeAttr(dir + "/power_role", "[source] sink");
+    writeAttr(dir + "/data_role", "[host] device");
+    writeAttr(dir + "/port_type", "[dual] source sink");
+    writeAttr(dir + "/power_operation_mode", "default");
+    writeAttr(partner + "/accessory_mode", "none");
+    writeAttr(partner + "/supports_usb_power_delivery", "no");
+
+    linkTo(dir, "/sys/class/typec/" + port);
+    linkTo(partner, "/sys/class/typec/" + port + "-partner");
+  }
+}
+
+// One USB device directory with a single interface, linked from
+// /sys/bus/usb/devices like the kernel does
+void buildDevice(const std::string &dir, const std::string &name, const std::string &interface,
+                 const char *interfaceClass, int pid) {
+  writeAttr(dir + "/idVendor", "05c6");
+  writeAttr(dir + "/idProduct", StringPrintf("%04x", pid));
+  writeAttr(dir + "/authorized", "1");
+  writeAttr(dir + "/power/control", "on");
+  writeAttr(dir + "/power/wakeup", "disabled");
+  writeAttr(dir + "/" + interface + "/bInterfaceClass", interfaceClass);
+
+  linkTo(dir, "/sys/bus/usb/devices/" + name);
+  linkTo(dir + "/" + interface, "/sys/bus/usb/devices/" + interface);
+}
+
+// Hubs on the root hub ports 1..hubs, devices round robin across them
+void buildUsbDevices(int hubs, int devices) {
+  buildDevice(kRootHub, "usb1", "1-0:1.0", "09", 0x0002);
+
+  for (int h = 0; h < hubs; h++) {
+    std::string name = StringPrintf("1-%d", h + 1);
+
+    buildDevice(std::string(kRootHub) + "/" + name, name, name + ":1.0", "09", 0x0100 + h);
+  }
+
+  for (int d = 0; d < devices; d++) {
+    int hub = hubs ? d % hubs : 0;
+    int port = hubs ? d / hubs + 1 : d + 1;
+    std::string parent = hubs ? StringPrintf("%s/1-%d", kRootHub, hub + 1) : kRootHub;
+    std::string name = hubs ? StringPrintf("1-%d.%d", hub + 1, port) : StringPrintf("1-%d", port);
+
+    buildDevice(parent + "/" + name, name, name + ":1.0",
+                kInterfaceClasses[d % (sizeof(kInterfaceClasses) / sizeof(*kInterfaceClasses))],
+                0x1000 + d);
+  }
+}
+
+void buildGadget() {
+  const std::string gadget = "/config/usb_gadget/g1/";
+
+  for (const char *attr : { "UDC", "idVendor", "idProduct", "bcdUSB" })
+    writeAttr(gadget + attr, "");
+  for (const char *attr : { "bDeviceClass", "bDeviceSubClass", "bDeviceProtocol" })
+    writeAttr(gadget + attr, "0");
+  for (const char *attr : { "manufacturer", "product", "serialnumber" })
+    writeAttr(gadget + "strings/0x409/" + attr, "");
+  writeAttr(gadget + "os_desc/use", "0");
+  writeAttr(gadget + "os_desc/b_vendor_code", "0x1");
+  writeAttr(gadget + "os_desc/qw_sign", "MSFT100");
+  writeAttr(gadget + "configs/b.1/MaxPower", "900");
+  writeAttr(gadget + "configs/b.1/bmAttributes", "0x80");
+  writeAttr(gadget + "configs/b.1/strings/0x409/configuration", "");
+
+  for (const char *function : kFunctionDirs)
+    makeDirs(gadget + "functions/" + function);
+  writeAttr(gadget + "functions/diag.diag/pid", "0x0");
+  for (const char *qdss : { "qdss.qdss", "qdss.qdss_mdm", "qdss.qdss_sw" })
+    writeAttr(gadget + "functions/" + qdss + "/enable_debug_inface", "0");
+
+  for (const char *ffs : { "adb", "mtp", "ptp" }) {
+    for (const char *ep : { "ep0", "ep1", "ep2", "ep3" })
+      writeAttr(StringPrintf("/dev/usb-ffs/%s/%s", ffs, ep), "");
+  }
+}
+
+}  // namespace
+
+int buildFakeTree(const std::string &rootDir, int ports, int hubs, int devices) {
+  root = rootDir;
+  while (root.size() > 1 && root.back() == '/')
+    root.pop_back();
+  failures = 0;
+
+  buildController();
+  buildPorts(ports);
+  buildUsbDevices(hubs, devices);
+  buildGadget();
+
+  return failures;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
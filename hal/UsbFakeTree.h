@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBFAKETREE_H
+#define ANDROID_HARDWARE_USB_QTI_USBFAKETREE_H
+
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Build a fake sysfs/configfs tree under root for running the USB and
+ * gadget HALs on a workstation with USB_HAL_FS_ROOT=<root>.
+ *
+ * The tree has the a600000 dwc3 controller in host mode
+ * (vendor.usb.controller must be a600000.dwc3), <ports> Type-C ports each
+ * with a partner attached, and <hubs> hubs on the xHCI root hub with
+ * <devices> devices spread across them. FunctionFS endpoints exist for
+ * adb, mtp and ptp, so FFS compositions see their descriptors as written.
+ *
+ * Existing entries are overwritten. Returns the number of entries that
+ * could not be created, each of which is reported on stderr.
+ */
+int buildFakeTree(const std::string &root, int ports, int hubs, int devices);
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBFAKETREE_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * Host tool: build a fake sysfs/configfs tree (see UsbFakeTree.h). Copy
+ * usb_compositions.conf to <root>/vendor/etc/ for the composition tables.
+ *
+ * usage: usb_fake_tree <root> [ports] [hubs] [devices]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "UsbFakeTree.h"
+
+using ::aidl::android::hardware::usb::buildFakeTree;
+
+static bool parseCount(const char *arg, int *count) {
+  char *end;
+  long value = strtol(arg, &end, 10);
+
+  if (*arg == '\0' || *end != '\0' || value < 0 || value > 4096)
+    return false;
+
+  *count = (int)value;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int ports = 1, hubs = 1, devices = 4;
+  int failures;
+
+  if (argc < 2 || argc > 5 || (argc > 2 && !parseCount(argv[2], &ports)) ||
+      (argc > 3 && !parseCount(argv[3], &hubs)) || (argc > 4 && !parseCount(argv[4], &devices))) {
+    fprintf(stderr, "usage: %s <root> [ports] [hubs] [devices]\n", argv[0]);
+    return 1;
+  }
+
+  failures = buildFakeTree(argv[1], ports, hubs, devices);
+  if (failures) {
+    fprintf(stderr, "%s: %d entries could not be created\n", argv[1], failures);
+    return 1;
+  }
+
+  printf("USB_HAL_FS_ROOT=%s: %d ports, %d hubs, %d devices\n", argv[1], ports, hubs, devices);
+  return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBFUNCTIONS_H
+#define ANDROID_HARDWARE_USB_QTI_USBFUNCTIONS_H
+
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Functions that can appear in a vendor composition (vendor.usb.config,
+ * usb_compositions.conf). The values are stored in the compiled
+ * composition table, so only ever append to this list.
+ */
+enum UsbFunctionId : uint8_t {
+  kFuncAdb,
+  kFuncCcid,
+  kFuncDiag,
+  kFuncDiagCnss,
+  kFuncDiagMdm2,
+  kFuncDiagMdm,
+  kFuncDpl,
+  kFuncMassStorage,
+  kFuncMtp,
+  kFuncNcm,
+  kFuncPtp,
+  kFuncQdss,
+  kFuncQdssDebug,
+  kFuncQdssMdm,
+  kFuncRmnet,
+  kFuncRndis,
+  kFuncSerialCdev,
+  kFuncSerialCdevNmea,
+  kFuncSerialCdevMdm,
+  kFuncUac2,
+  kFuncUvc,
+  kFuncCount,
+};
+
+// Names as used in composition strings, indexed by UsbFunctionId
+constexpr const char *kUsbFunctionNames[kFuncCount] = {
+  "adb",
+  "ccid",
+  "diag",
+  "diag_cnss",
+  "diag_mdm2",
+  "diag_mdm",
+  "dpl",
+  "mass_storage",
+  "mtp",
+  "ncm",
+  "ptp",
+  "qdss",
+  "qdss_debug",
+  "qdss_mdm",
+  "rmnet",
+  "rndis",
+  "serial_cdev",
+  "serial_cdev_nmea",
+  "serial_cdev_mdm",
+  "uac2",
+  "uvc",
+};
+
+// Returns the id of a function name, or -1 if it is not supported
+inline int usbFunctionId(std::string_view name) {
+  for (int i = 0; i < kFuncCount; i++) {
+    if (name == kUsbFunctionNames[i])
+      return i;
+  }
+
+  return -1;
+}
+
+#define DIAG_FUNC_NAME_PROP "vendor.usb.diag.func.name"
+#define RNDIS_FUNC_NAME_PROP "vendor.usb.rndis.func.name"
+#define RMNET_FUNC_NAME_PROP "vendor.usb.rmnet.func.name"
+#define RMNET_INST_NAME_PROP "vendor.usb.rmnet.inst.name"
+#define DPL_INST_NAME_PROP "vendor.usb.dpl.inst.name"
+#define QDSS_INST_NAME_PROP "vendor.usb.qdss.inst.name"
+
+/*
+ * configfs function directory of a composition function. Some depend on
+ * the target's function drivers, which are read through
+ * getProperty(name, defaultValue) so that the gadget HAL can use its
+ * property snapshot and one-shot tools plain GetProperty().
+ */
+template <typename GetProperty>
+std::string functionDirName(int id, GetProperty getProperty) {
+  switch (id) {
+    case kFuncAdb:
+      return "ffs.adb";
+    case kFuncCcid:
+      return "ccid.ccid";
+    case kFuncDiag:
+      return getProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag";
+    case kFuncDiagCnss:
+    case kFuncDiagMdm2:
+      return getProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag_mdm2";
+    case kFuncDiagMdm:
+      return getProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag_mdm";
+    case kFuncDpl:
+      return getProperty(RMNET_FUNC_NAME_PROP, "gsi") + "." +
+             getProperty(DPL_INST_NAME_PROP, "dpl");
+    case kFuncMassStorage:
+      return "mass_storage.0";
+    case kFuncMtp:
+      return "ffs.mtp";
+    case kFuncNcm:
+      return "ncm.gs6";
+    case kFuncPtp:
+      return "ffs.ptp";
+    case kFuncQdss:
+    case kFuncQdssDebug:
+      return "qdss." + getProperty(QDSS_INST_NAME_PROP, "qdss");
+    case kFuncQdssMdm:
+      return "qdss.qdss_mdm";
+    case kFuncRmnet:
+      return getProperty(RMNET_FUNC_NAME_PROP, "gsi") + "." +
+             getProperty(RMNET_INST_NAME_PROP, "rmnet");
+    case kFuncRndis: {
+      std::string rndisFunc = getProperty(RNDIS_FUNC_NAME_PROP, "");
+
+      return rndisFunc.empty() ? "rndis" : rndisFunc + ".rndis";
+    }
+    case kFuncSerialCdev:
+      return "cser.dun.0";
+    case kFuncSerialCdevNmea:
+      return "cser.nmea.1";
+    case kFuncSerialCdevMdm:
+      return "cser.dun.2";
+    case kFuncUac2:
+      return "uac2.0";
+    case kFuncUvc:
+      return "uvc.0";
+  }
+
+  return "";
+}
+
+/*
+ * An ordered set of composition functions: a bitmask for membership tests
+ * and hashing plus the order the functions are to be linked in. Trivially
+ * copyable, so it is also stored as is in the compiled composition table.
+ */
+class FunctionSet {
+ public:
+  // Append id; false if it is already present or invalid
+  bool add(int id) {
+    if (id < 0 || id >= kFuncCount || contains(id))
+      return false;
+
+    mMask |= 1u << id;
+    mOrder[mCount++] = id;
+    return true;
+  }
+
+  bool contains(int id) const { return mMask & (1u << id); }
+  uint32_t mask() const { return mMask; }
+  bool empty() const { return mCount == 0; }
+  size_t size() const { return mCount; }
+  UsbFunctionId operator[](size_t i) const { return (UsbFunctionId)mOrder[i]; }
+  const uint8_t *begin() const { return mOrder; }
+  const uint8_t *end() const { return mOrder + mCount; }
+
+  // Same functions in the same order
+  bool operator==(const FunctionSet &other) const {
+    return mMask == other.mMask && mCount == other.mCount &&
+           std::equal(begin(), end(), other.begin());
+  }
+  bool operator!=(const FunctionSet &other) const { return !(*this == other); }
+
+  // Same members regardless of order
+  bool sameMembers(const FunctionSet &other) const { return mMask == other.mMask; }
+
+  // The members ordered by id
+  FunctionSet canonical() const {
+    FunctionSet set;
+
+    for (int id = 0; id < kFuncCount; id++) {
+      if (contains(id))
+        set.add(id);
+    }
+    return set;
+  }
+
+  // Order independent; members are unique so the mask identifies the set
+  size_t hash() const { return std::hash<uint32_t>()(mMask); }
+
+  // Consistency check for sets read from untrusted storage
+  bool valid() const {
+    uint32_t mask = 0;
+
+    if (mCount > kFuncCount)
+      return false;
+    for (uint8_t id : *this) {
+      if (id >= kFuncCount || (mask & (1u << id)))
+        return false;
+      mask |= 1u << id;
+    }
+    return mask == mMask;
+  }
+
+  /*
+   * Parse a comma separated composition string such as "diag,adb" without
+   * allocating. Fails on unknown or repeated functions.
+   */
+  static bool parse(std::string_view str, FunctionSet *set) {
+    *set = FunctionSet();
+
+    while (!str.empty()) {
+      size_t comma = str.find(',');
+
+      if (!set->add(usbFunctionId(str.substr(0, comma))))
+        return false;
+
+      if (comma == std::string_view::npos)
+        break;
+      str.remove_prefix(comma + 1);
+    }
+
+    return !set->empty();
+  }
+
+  // "diag,adb"; only for logging and configfs writes
+  std::string toString() const {
+    std::string str;
+
+    for (uint8_t id : *this) {
+      if (!str.empty())
+        str += ',';
+      str += kUsbFunctionNames[id];
+    }
+    return str;
+  }
+
+ private:
+  uint32_t mMask = 0;
+  uint8_t mCount = 0;
+  uint8_t mOrder[kFuncCount] = {};
+};
+
+static_assert(kFuncCount <= 32, "FunctionSet mask is 32 bits");
+
+struct FunctionSetHash {
+  size_t operator()(const FunctionSet &set) const { return set.hash(); }
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBFUNCTIONS_H
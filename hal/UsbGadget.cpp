@@ -23,35 +23,37 @@
 
 #define LOG_TAG "android.hardware.usb.gadget-service.qti"
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
+#include <chrono>
 #include <functional>
 #include <map>
-#include <tuple>
-#include <fstream>
-#include <sstream>
+#include <thread>
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <UsbGadgetCommon.h>
+#include "UsbCompositionTable.h"
+#include "UsbFunctions.h"
 #include "UsbGadget.h"
+#include "UsbProperties.h"
 
 #define USB_CONTROLLER_PROP "vendor.usb.controller"
-#define DIAG_FUNC_NAME_PROP "vendor.usb.diag.func.name"
-#define RNDIS_FUNC_NAME_PROP "vendor.usb.rndis.func.name"
-#define RMNET_FUNC_NAME_PROP "vendor.usb.rmnet.func.name"
-#define RMNET_INST_NAME_PROP "vendor.usb.rmnet.inst.name"
-#define DPL_INST_NAME_PROP "vendor.usb.dpl.inst.name"
 #define VENDOR_USB_PROP "vendor.usb.config"
 #define PERSIST_VENDOR_USB_PROP "persist.vendor.usb.config"
 #define PERSIST_VENDOR_USB_EXTRA_PROP "persist.vendor.usb.config.extra"
-#define QDSS_INST_NAME_PROP "vendor.usb.qdss.inst.name"
+#define PERSIST_GADGET_FUNCTIONS_PROP "persist.vendor.usb.gadget.functions"
 #define CONFIG_STRING CONFIG_PATH "strings/0x409/configuration"
 
 namespace aidl {
@@ -60,51 +62,74 @@ namespace hardware {
 namespace usb {
 namespace gadget {
 
+using ::android::base::boot_clock;
 using ::android::base::GetProperty;
+using ::android::base::ParseUint;
 using ::android::base::SetProperty;
+using ::android::base::StringPrintf;
 using ::android::base::Trim;
 using ::android::base::WriteStringToFile;
 using ::android::base::ReadFileToString;
-using ::android::hardware::usb::gadget::addAdb;
 using ::android::hardware::usb::gadget::kDisconnectWaitUs;
-using ::android::hardware::usb::gadget::linkFunction;
-using ::android::hardware::usb::gadget::resetGadget;
-using ::android::hardware::usb::gadget::setVidPid;
-using ::android::hardware::usb::gadget::unlinkFunctions;
-
-static std::map<std::string, std::tuple<std::string, std::string, std::string> >
-supported_compositions;
-
-static void createCompositionsMap(std:: string fileName) {
-  std::ifstream compositions(fileName);
-  std::string line;
+using ConfigfsStatus = ::android::hardware::usb::gadget::V1_0::Status;
+
+// Properties read on composition switches, kept current by a watcher
+static PropertySnapshot usbProperties({
+  USB_CONTROLLER_PROP,
+  DIAG_FUNC_NAME_PROP,
+  RNDIS_FUNC_NAME_PROP,
+  RMNET_FUNC_NAME_PROP,
+  RMNET_INST_NAME_PROP,
+  DPL_INST_NAME_PROP,
+  VENDOR_USB_PROP,
+  PERSIST_VENDOR_USB_PROP,
+  PERSIST_VENDOR_USB_EXTRA_PROP,
+  QDSS_INST_NAME_PROP,
+});
+
+// /vendor compositions compiled at build time
+static CompositionTable compositionTable;
+// Compositions parsed from text: /odm and /product overrides, and /vendor
+// when there is no compiled table
+static CompositionMap supported_compositions;
+
+// How long to wait for a host to configure the gadget after the first pullup
+constexpr auto kEnumerationWatchTime = std::chrono::seconds(60);
+
+// Compositions most switched between, planned at startup
+static const uint64_t commonCompositions[] = {
+  static_cast<uint64_t>(GadgetFunction::ADB),
+  GadgetFunction::MTP | GadgetFunction::ADB,
+  GadgetFunction::RNDIS | GadgetFunction::ADB,
+};
 
-  while (std::getline(compositions, line)) {
-    std::string prop;
-    std::tuple<std::string, std::string, std::string> vpa;
-    // Ignore comments in the file
-    auto pos = line.find('#');
-    if (pos != std::string::npos)
-      line.erase(pos);
+UsbGadget::UsbGadget(const char* const gadget)
+    : mCurrentUsbFunctions(0),
+      mCurrentUsbFunctionsApplied(false),
+      mMonitorFfs(gadget),
+      mPlanApplied(false),
+      mPlanCacheGeneration(UINT64_MAX),
+      mPersistedFunctions(0),
+      mEnumerationWatched(false),
+      mSwitchId(0) {
+  if (access(fsPath(CONFIG_PATH).c_str(), R_OK) != 0)
+    ALOGE("configfs setup not done yet");
 
-    std::stringstream words(line);
+  usbProperties.start();
+  std::thread(&UsbGadget::pendingTimeoutLoop, this).detach();
 
-    words >> prop >> std::get<0>(vpa) >> std::get<1>(vpa) >> std::get<2>(vpa);
-    // If we get vpa[1], we have the three minimum values needed. Or else we skip
-    if (!std::get<1>(vpa).empty())
-      supported_compositions.insert_or_assign(prop, vpa);
-  }
-}
+  if (compositionTable.open(fsPath("/vendor/etc/usb_compositions.bin")))
+    ALOGI("Loaded %zu compiled compositions", compositionTable.size());
+  else
+    readCompositionsConf(fsPath("/vendor/etc/usb_compositions.conf"), supported_compositions);
+  readCompositionsConf(fsPath("/odm/etc/usb_compositions.conf"), supported_compositions);
+  readCompositionsConf(fsPath("/product/etc/usb_compositions.conf"), supported_compositions);
 
-UsbGadget::UsbGadget(const char* const gadget)
-    : mCurrentUsbFunctionsApplied(false),
-      mMonitorFfs(gadget) {
-  if (access(CONFIG_PATH, R_OK) != 0)
-    ALOGE("configfs setup not done yet");
+  // Plan the usual compositions ahead of the first switch to them
+  for (uint64_t functions : commonCompositions)
+    cachedPlan(functions);
 
-  createCompositionsMap("/vendor/etc/usb_compositions.conf");
-  createCompositionsMap("/odm/etc/usb_compositions.conf");
-  createCompositionsMap("/product/etc/usb_compositions.conf");
+  stageLastFunctions();
 }
 
 ScopedAStatus UsbGadget::getCurrentUsbFunctions(
@@ -130,7 +155,7 @@ ScopedAStatus UsbGadget::reset(const shared_ptr<IUsbGadgetCallback> &callback,
   if (callback == nullptr)
     return ScopedAStatus::fromExceptionCode(EX_NULL_POINTER);
 
-  if (!WriteStringToFile("none", PULLUP_PATH)) {
+  if (!WriteStringToFile("none", fsPath(PULLUP_PATH))) {
     ALOGE("reset(): unable to clear pullup");
     return ScopedAStatus::fromServiceSpecificError(-1);
   }
@@ -145,11 +170,15 @@ ScopedAStatus UsbGadget::getUsbSpeed(const shared_ptr<IUsbGadgetCallback> &callb
   if (callback == nullptr)
     return ScopedAStatus::fromExceptionCode(EX_NULL_POINTER);
 
-  std::string gadgetName = GetProperty(USB_CONTROLLER_PROP, "");
-  std::string current_speed;
-  if (ReadFileToString("/sys/class/udc/" + gadgetName + "/current_speed",
-                          &current_speed)) {
-      current_speed = Trim(current_speed);
+  std::string gadgetName = usbProperties.get(USB_CONTROLLER_PROP);
+  std::string speedPath = fsPath("/sys/class/udc/") + gadgetName + "/current_speed";
+  char buf[32];
+
+  if (mUdcSpeed.path() != speedPath)
+    mUdcSpeed.setPath(speedPath);
+
+  if (mUdcSpeed.read(buf, sizeof(buf)) >= 0) {
+      std::string_view current_speed(buf);
 
       UsbSpeed speed = UsbSpeed::UNKNOWN;
       if (current_speed == "low-speed")
@@ -170,308 +199,972 @@ ScopedAStatus UsbGadget::getUsbSpeed(const shared_ptr<IUsbGadgetCallback> &callb
   return ScopedAStatus::fromServiceSpecificError(-1);
 }
 
+/*
+ * The libusbconfigfs gadget helpers, with every path resolved through
+ * fsPath() so that a fake tree is never mixed with the real configfs.
+ */
+static int linkFunction(const char *function, int index) {
+  std::string target = fsPath(FUNCTIONS_PATH) + function;
+  std::string link = fsPath(FUNCTION_PATH) + std::to_string(index);
+
+  if (symlink(target.c_str(), link.c_str())) {
+    ALOGE("Cannot create symlink %s -> %s errno:%d", link.c_str(), target.c_str(), errno);
+    return -1;
+  }
+
+  return 0;
+}
+
+static ConfigfsStatus setVidPid(const char *vid, const char *pid) {
+  if (!WriteStringToFile(vid, fsPath(VENDOR_ID_PATH)) ||
+      !WriteStringToFile(pid, fsPath(PRODUCT_ID_PATH)))
+    return ConfigfsStatus::ERROR;
+
+  return ConfigfsStatus::SUCCESS;
+}
+
+// Every function link of configs/b.1, whoever made it, including the fN
+// links of the init compositions
+static bool unlinkAllFunctions() {
+  std::string configPath = fsPath(CONFIG_PATH);
+  DIR *dir = opendir(configPath.c_str());
+  struct dirent *entry;
+  struct stat st;
+  bool ok = true;
+
+  if (dir == NULL)
+    return false;
+
+  while ((entry = readdir(dir))) {
+    std::string path = configPath + entry->d_name;
+
+    if (lstat(path.c_str(), &st) || !S_ISLNK(st.st_mode))
+      continue;
+
+    if (unlink(path.c_str())) {
+      ALOGE("Unable to unlink %s errno:%d", entry->d_name, errno);
+      ok = false;
+    }
+  }
+  closedir(dir);
+
+  return ok;
+}
+
+static ConfigfsStatus resetGadget() {
+  ALOGI("setCurrentUsbFunctions None");
+
+  if (!WriteStringToFile("none", fsPath(PULLUP_PATH)))
+    ALOGI("Gadget cannot be pulled down");
+
+  if (!WriteStringToFile("0", fsPath(DEVICE_CLASS_PATH)) ||
+      !WriteStringToFile("0", fsPath(DEVICE_SUB_CLASS_PATH)) ||
+      !WriteStringToFile("0", fsPath(DEVICE_PROTOCOL_PATH)) ||
+      !WriteStringToFile("0", fsPath(DESC_USE_PATH)) ||
+      !unlinkAllFunctions())
+    return ConfigfsStatus::ERROR;
+
+  return ConfigfsStatus::SUCCESS;
+}
+
+static bool watchFfs(MonitorFfs &monitorFfs, UsbFunctionId instance) {
+  std::string dir = fsPath("/dev/usb-ffs/") + kUsbFunctionNames[instance] + "/";
+
+  if (!monitorFfs.addInotifyFd(dir))
+    return false;
+
+  // adb has a bulk pair; mtp and ptp add an interrupt endpoint
+  monitorFfs.addEndPoint(dir + "ep1");
+  monitorFfs.addEndPoint(dir + "ep2");
+  if (instance != kFuncAdb)
+    monitorFfs.addEndPoint(dir + "ep3");
+
+  return true;
+}
+
+static ConfigfsStatus linkAdb(MonitorFfs &monitorFfs, int &functionCount) {
+  if (!watchFfs(monitorFfs, kFuncAdb) || linkFunction("ffs.adb", functionCount++))
+    return ConfigfsStatus::ERROR;
+
+  return ConfigfsStatus::SUCCESS;
+}
+
+// MTP or PTP, MIDI, accessory and audio source; RNDIS and NCM always take
+// the vendor composition path
+static ConfigfsStatus linkAndroidFunctions(MonitorFfs &monitorFfs, uint64_t functions,
+                                           bool &ffsEnabled, int &functionCount) {
+  static const std::pair<uint64_t, const char *> kLegacyFunctions[] = {
+    { GadgetFunction::MIDI, "midi.gs5" },
+    { GadgetFunction::ACCESSORY, "accessory.gs2" },
+    { GadgetFunction::AUDIO_SOURCE, "audio_source.gs3" },
+  };
+
+  if (functions & (GadgetFunction::MTP | GadgetFunction::PTP)) {
+    UsbFunctionId id = (functions & GadgetFunction::MTP) ? kFuncMtp : kFuncPtp;
+
+    ffsEnabled = true;
+    if (!WriteStringToFile("1", fsPath(DESC_USE_PATH)) || !watchFfs(monitorFfs, id) ||
+        linkFunction(id == kFuncMtp ? "ffs.mtp" : "ffs.ptp", functionCount++))
+      return ConfigfsStatus::ERROR;
+  }
+
+  for (auto & [function, dir] : kLegacyFunctions) {
+    if ((functions & function) && linkFunction(dir, functionCount++))
+      return ConfigfsStatus::ERROR;
+  }
+
+  return ConfigfsStatus::SUCCESS;
+}
+
+// dumpsys android.hardware.usb.gadget.IUsbGadget/default
+binder_status_t UsbGadget::dump(int fd, const char **args, uint32_t numArgs) {
+  ::android::base::WriteStringToFd(StringPrintf("Current functions: 0x%llx, %s\n",
+                                                (unsigned long long)mCurrentUsbFunctions,
+                                                mCurrentUsbFunctionsApplied ? "applied" :
+                                                "not applied"), fd);
+  mSwitchLatency.dump(fd);
+  return STATUS_OK;
+}
+
 Status UsbGadget::tearDownGadget() {
   if (mMonitorFfs.isMonitorRunning())
     mMonitorFfs.reset();
   else
     ALOGE("mMonitor not running");
 
-  if (resetGadget() != ::android::hardware::usb::gadget::V1_0::Status::SUCCESS)
+  if (resetGadget() != ConfigfsStatus::SUCCESS)
     return Status::ERROR;
 
-  if (remove(OS_DESC_PATH))
+  if (remove(fsPath(OS_DESC_PATH).c_str()))
     ALOGI("Unable to remove file %s errno:%d", OS_DESC_PATH, errno);
 
   return Status::SUCCESS;
 }
 
-static std::string rndisFuncname() {
-  std::string rndisFunc = GetProperty(RNDIS_FUNC_NAME_PROP, "");
-
-  if (rndisFunc.empty()) {
-    return "rndis";
+/*
+ * functionDirName() of every function resolved against the current
+ * property snapshot, rebuilt when any snapshot property changes. Only used
+ * under mLockSetCurrentFunction.
+ */
+static std::string functionDirs[kFuncCount];
+static uint64_t functionDirsGeneration = UINT64_MAX;
+
+static const std::string &functionDir(uint8_t id) {
+  uint64_t generation = usbProperties.generation();
+
+  if (generation != functionDirsGeneration) {
+    for (int i = 0; i < kFuncCount; i++)
+      functionDirs[i] = functionDirName(i, [](const char *name, const char *defaultValue) {
+        return usbProperties.get(name, defaultValue);
+      });
+    functionDirsGeneration = generation;
   }
 
-  return rndisFunc + ".rndis";
+  return functionDirs[id];
 }
 
-static std::string qdssFuncname(const char *debug) {
-  auto qdss = "qdss." + GetProperty(QDSS_INST_NAME_PROP, "qdss");
-  auto debug_iface = FUNCTIONS_PATH + qdss + "/enable_debug_inface";
+// Text overrides take precedence over the compiled /vendor table
+static const Composition *lookupComposition(const FunctionSet &key) {
+  auto it = supported_compositions.find(key);
 
-  WriteStringToFile(debug, debug_iface.c_str());
+  if (it != supported_compositions.end())
+    return &it->second;
 
-  return qdss;
+  return compositionTable.find(key);
 }
 
-static std::map<std::string, std::function<std::string()> > supported_funcs {
-  { "adb",              [](){ return "ffs.adb"; } },
-  { "ccid",             [](){ return "ccid.ccid"; } },
-  { "diag",             [](){ return GetProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag"; } },
-  { "diag_cnss",        [](){ return GetProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag_mdm2"; } },
-  { "diag_mdm2",        [](){ return GetProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag_mdm2"; } },
-  { "diag_mdm",         [](){ return GetProperty(DIAG_FUNC_NAME_PROP, "diag") + ".diag_mdm"; } },
-  { "dpl",              [](){ return GetProperty(RMNET_FUNC_NAME_PROP, "gsi") + "." + GetProperty(DPL_INST_NAME_PROP, "dpl"); } },
-  { "mass_storage",     [](){ return "mass_storage.0"; } },
-  { "mtp",              [](){ return "ffs.mtp"; } },
-  { "ncm",              [](){ return "ncm.gs6"; } },
-  { "ptp",              [](){ return "ffs.ptp"; } },
-  { "qdss",             [](){ return qdssFuncname("0"); } },
-  { "qdss_debug",       [](){ return qdssFuncname("1"); } },
-  { "qdss_mdm",         [](){ return "qdss.qdss_mdm"; } },
-  { "rmnet",            [](){ return GetProperty(RMNET_FUNC_NAME_PROP, "gsi") + "." + GetProperty(RMNET_INST_NAME_PROP, "rmnet"); } },
-  { "rndis",            rndisFuncname },
-  { "serial_cdev",      [](){ return "cser.dun.0"; } },
-  { "serial_cdev_nmea", [](){ return "cser.nmea.1"; } },
-  { "serial_cdev_mdm",  [](){ return "cser.dun.2"; } },
-  { "uac2",             [](){ return "uac2.0"; } },
-  { "uvc",              [](){ return "uvc.0"; } },
-};
+/*
+ * The vendor composition that replaces the standard Android functions, if
+ * any: tethering combined with persist.vendor.usb.config.extra, or adb-only
+ * overridden by vendor.usb.config. key is left empty if the property names
+ * an unknown function.
+ */
+static bool vendorCompositionKey(uint64_t functions, FunctionSet *key) {
+  *key = FunctionSet();
+
+  if (((functions & GadgetFunction::RNDIS) != 0) ||
+       ((functions & GadgetFunction::NCM) != 0)) {
+    std::string vendorExtraProp = usbProperties.get(PERSIST_VENDOR_USB_EXTRA_PROP, "none");
+    FunctionSet extra;
+
+    key->add((functions & GadgetFunction::RNDIS) ? kFuncRndis : kFuncNcm);
+
+    if (vendorExtraProp != "none") {
+      if (!FunctionSet::parse(vendorExtraProp, &extra)) {
+        ALOGE("Composition \"%s\" unsupported", vendorExtraProp.c_str());
+        *key = FunctionSet();
+        return true;
+      }
+      for (uint8_t id : extra)
+        key->add(id);
+    }
+
+    if (functions & GadgetFunction::ADB)
+      key->add(kFuncAdb);
+    return true;
+  }
+
+  if (functions != static_cast<uint64_t>(GadgetFunction::ADB))
+    return false;
+
+  std::string vendorProp = usbProperties.get(VENDOR_USB_PROP,
+                                             usbProperties.get(PERSIST_VENDOR_USB_PROP));
+  if (vendorProp.empty() || vendorProp == "adb")
+    return false;
+
+  // override adb-only with additional QTI functions if vendor.usb.config
+  // or persist.vendor.usb.config is set
+  ALOGI("setting composition from %s: %s", VENDOR_USB_PROP, vendorProp.c_str());
+
+  if (!FunctionSet::parse(vendorProp, key)) {
+    ALOGE("Composition \"%s\" unsupported", vendorProp.c_str());
+    *key = FunctionSet();
+    return true;
+  }
+
+  // tack on ADB if not there, since we only arrive here if "USB debugging
+  // enabled" is chosen which implies ADB
+  key->add(kFuncAdb);
+  return true;
+}
 
-int UsbGadget::addFunctionsFromPropString(std::string prop, bool &ffsEnabled, int &i) {
-  if (!supported_compositions.count(prop)) {
-    ALOGE("Composition \"%s\" unsupported", prop.c_str());
+/*
+ * Resolve a vendor composition into the functions to link, in order, and
+ * the VID/PID to use. Nothing is written to configfs.
+ */
+static int planVendorComposition(const FunctionSet &key, GadgetPlan &plan) {
+  const Composition *composition = key.empty() ? nullptr : lookupComposition(key);
+
+  if (composition == nullptr) {
+    if (!key.empty())
+      ALOGE("Composition \"%s\" unsupported", key.toString().c_str());
     return -1;
   }
 
-  auto [vid, pid, actual_order] = supported_compositions[prop];
-  ALOGE("vid %s pid %s", vid.c_str(), pid.c_str());
+  ALOGI("vid 0x%04x pid 0x%04x", composition->vid, composition->pid);
 
-  // some compositions differ from the order given in the property string
-  // e.g. ADB may appear somewhere in the middle instead of being last
-  if (!actual_order.empty())
-    prop = actual_order;
+  // some compositions differ from the order of the key, e.g. ADB may
+  // appear somewhere in the middle instead of being last
+  plan.configuration = composition->functions.toString();
+  plan.vid = composition->vid;
+  plan.pid = composition->pid;
 
-  WriteStringToFile(prop, CONFIG_STRING);
+  for (uint8_t id : composition->functions) {
+    if (id == kFuncAdb)
+      plan.ffs.add(kFuncAdb);
 
-  // tokenize the prop string and add each function individually
-  for (size_t start = 0; start != std::string::npos; ) {
-    size_t end = prop.find_first_of(',', start);
-    std::string funcname;
-    if (end == std::string::npos) {
-      funcname = prop.substr(start, prop.length() - start);
-      start = end;
-    } else {
-      funcname = prop.substr(start, end - start);
-      start = end + 1;
-    }
+    // Set Diag PID for QC DLOAD mode
+    if (plan.functions.empty() && composition->vid == 0x05c6 && id == kFuncDiag)
+      plan.diagPid = true;
 
-    if (!supported_funcs.count(funcname)) {
-      ALOGE("Function \"%s\" unsupported", funcname.c_str());
-      return -1;
-    }
+    plan.functions.push_back(functionDir(id));
 
-    ALOGI("Adding %s", funcname.c_str());
-    if (funcname == "adb") {
-      if (addAdb(&mMonitorFfs, &i) != ::android::hardware::usb::gadget::V1_0::Status::SUCCESS)
+    if (id == kFuncQdss || id == kFuncQdssDebug)
+      plan.attributes.emplace_back(plan.functions.back() + "/enable_debug_inface",
+                                   id == kFuncQdssDebug ? "1" : "0");
+  }
+
+  return 0;
+}
+
+int UsbGadget::addVendorFunctions(const FunctionSet &key, bool &ffsEnabled, int &i) {
+  GadgetPlan plan;
+
+  if (planVendorComposition(key, plan))
+    return -1;
+
+  for (auto & [attribute, value] : plan.attributes)
+    WriteStringToFile(value, fsPath(FUNCTIONS_PATH) + attribute);
+
+  WriteStringToFile(plan.configuration, fsPath(CONFIG_STRING));
+
+  for (auto &function : plan.functions) {
+    ALOGI("Adding %s", function.c_str());
+    if (function == "ffs.adb") {
+      if (linkAdb(mMonitorFfs, i) != ConfigfsStatus::SUCCESS)
         return -1;
       ffsEnabled = true;
-    } else if (linkFunction(supported_funcs[funcname]().c_str(), i))
+      continue;
+    } else if (linkFunction(function.c_str(), i)) {
       return -1;
+    }
 
-    // Set Diag PID for QC DLOAD mode
-    if (i == 0 && !strcasecmp(vid.c_str(), "0x05c6") && funcname == "diag")
-      WriteStringToFile(pid, FUNCTIONS_PATH "diag.diag/pid");
+    if (i == 0 && plan.diagPid)
+      WriteStringToFile(StringPrintf("0x%04x", plan.pid), fsPath(FUNCTIONS_PATH "diag.diag/pid"));
 
     ++i;
   }
 
-  if (setVidPid(vid.c_str(), pid.c_str()) != ::android::hardware::usb::gadget::V1_0::Status::SUCCESS)
+  if (setVidPid(StringPrintf("0x%04x", plan.vid).c_str(),
+                StringPrintf("0x%04x", plan.pid).c_str()) !=
+      ConfigfsStatus::SUCCESS)
     return -1;
 
   return 0;
 }
 
-static Status validateAndSetVidPid(uint64_t functions) {
-  ::android::hardware::usb::gadget::V1_0::Status ret =
-    ::android::hardware::usb::gadget::V1_0::Status::SUCCESS;
+// PID of the Google VID composition for the standard Android functions, 0 if none
+static uint16_t androidPid(uint64_t functions) {
   switch (functions) {
     case static_cast<uint64_t>(GadgetFunction::ADB):
-      ret = setVidPid("0x18d1", "0x4e11");
-      break;
+      return 0x4e11;
     case static_cast<uint64_t>(GadgetFunction::MTP):
-      ret = setVidPid("0x18d1", "0x4ee1");
-      break;
+      return 0x4ee1;
     case GadgetFunction::ADB | GadgetFunction::MTP:
-      ret = setVidPid("0x18d1", "0x4ee2");
-      break;
+      return 0x4ee2;
     case static_cast<uint64_t>(GadgetFunction::RNDIS):
-      ret = setVidPid("0x18d1", "0x4ee3");
-      break;
+      return 0x4ee3;
     case GadgetFunction::ADB | GadgetFunction::RNDIS:
-      ret = setVidPid("0x18d1", "0x4ee4");
-      break;
+      return 0x4ee4;
     case static_cast<uint64_t>(GadgetFunction::PTP):
-      ret = setVidPid("0x18d1", "0x4ee5");
-      break;
+      return 0x4ee5;
     case GadgetFunction::ADB | GadgetFunction::PTP:
-      ret = setVidPid("0x18d1", "0x4ee6");
-      break;
+      return 0x4ee6;
     case static_cast<uint64_t>(GadgetFunction::MIDI):
-      ret = setVidPid("0x18d1", "0x4ee8");
-      break;
+      return 0x4ee8;
     case GadgetFunction::ADB | GadgetFunction::MIDI:
-      ret = setVidPid("0x18d1", "0x4ee9");
-      break;
+      return 0x4ee9;
     case static_cast<uint64_t>(GadgetFunction::ACCESSORY):
-      ret = setVidPid("0x18d1", "0x2d00");
-      break;
+      return 0x2d00;
     case GadgetFunction::ADB | GadgetFunction::ACCESSORY:
-      ret = setVidPid("0x18d1", "0x2d01");
-      break;
+      return 0x2d01;
     case static_cast<uint64_t>(GadgetFunction::AUDIO_SOURCE):
-      ret = setVidPid("0x18d1", "0x2d02");
-      break;
+      return 0x2d02;
     case GadgetFunction::ADB | GadgetFunction::AUDIO_SOURCE:
-      ret = setVidPid("0x18d1", "0x2d03");
-      break;
+      return 0x2d03;
     case GadgetFunction::ACCESSORY | GadgetFunction::AUDIO_SOURCE:
-      ret = setVidPid("0x18d1", "0x2d04");
-      break;
+      return 0x2d04;
     case GadgetFunction::ADB | GadgetFunction::ACCESSORY |
 	    GadgetFunction::AUDIO_SOURCE:
-      ret = setVidPid("0x18d1", "0x2d05");
-      break;
+      return 0x2d05;
     case static_cast<uint64_t>(GadgetFunction::NCM):
-      ret = setVidPid("0x18d1", "0x4eeb");
-      break;
+      return 0x4eeb;
     case GadgetFunction::ADB | GadgetFunction::NCM:
-      ret = setVidPid("0x18d1", "0x4eec");
-      break;
+      return 0x4eec;
     default:
-      ALOGE("Combination not supported");
-      ret = ::android::hardware::usb::gadget::V1_0::Status::CONFIGURATION_NOT_SUPPORTED;
+      return 0;
+  }
+}
+
+static Status validateAndSetVidPid(uint64_t functions) {
+  ConfigfsStatus ret = ConfigfsStatus::SUCCESS;
+  uint16_t pid = androidPid(functions);
+
+  if (pid == 0) {
+    ALOGE("Combination not supported");
+    ret = ConfigfsStatus::CONFIGURATION_NOT_SUPPORTED;
+  } else {
+    ret = setVidPid("0x18d1", StringPrintf("0x%04x", pid).c_str());
   }
   return static_cast<Status>(ret);
 }
 
+/*
+ * Monitor the ffs paths to pull up the gadget when descriptors are written.
+ * Also takes care of pulling up the gadget again if the userspace process
+ * dies and restarts. The request completes from the monitor's pullup, or
+ * with ERROR after timeout ms, without blocking the caller.
+ */
+void UsbGadget::startFfsMonitor(uint64_t functions,
+                                const shared_ptr<IUsbGadgetCallback> &callback,
+                                int64_t timeout, int64_t in_transactionId) {
+  setPending(functions, callback, timeout, in_transactionId);
+
+  mMonitorFfs.registerFunctionsAppliedCallback(
+      [](bool functionsApplied, void *payload) {
+        ((UsbGadget*)payload)->functionsApplied(functionsApplied);
+      }, this);
+  mMonitorFfs.startMonitor();
+  mSwitchLatency.mark(kStageFfsMonitor, mSwitchId);
+
+  ALOGI("Started monitor for FFS functions");
+}
+
+// Complete the request on the next pullup, or with ERROR after timeout ms
+void UsbGadget::setPending(uint64_t functions, const shared_ptr<IUsbGadgetCallback> &callback,
+                           int64_t timeout, int64_t in_transactionId) {
+  if (!callback)
+    return;
+
+  std::lock_guard<std::mutex> lock(mPendingLock);
+
+  mPending = PendingFunctions{ functions, callback, in_transactionId, mRequestStart,
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout), mSwitchId };
+  mPendingCV.notify_one();
+}
+
+// Called from the FFS monitor thread on every pullup and pulldown
+void UsbGadget::functionsApplied(bool applied) {
+  mCurrentUsbFunctionsApplied = applied;
+
+  if (applied) {
+    completePending(Status::SUCCESS);
+    watchEnumeration();
+  }
+}
+
+static void reportFunctions(const PendingFunctions &pending, Status status) {
+  ScopedAStatus ret = pending.callback->setCurrentUsbFunctionsCb(
+      pending.functions, status, pending.transactionId);
+  if (!ret.isOk())
+    ALOGE("setCurrentUsbFunctionsCb error %s", ret.getDescription().c_str());
+}
+
+void UsbGadget::completePending(Status status) {
+  std::optional<PendingFunctions> pending;
+
+  {
+    std::lock_guard<std::mutex> lock(mPendingLock);
+    pending.swap(mPending);
+  }
+
+  if (!pending)
+    return;
+
+  // Charged to the switch of the request, which may no longer be the open one
+  if (status == Status::SUCCESS) {
+    mSwitchLatency.mark(kStagePullup, pending->switchId);
+    ALOGI("Gadget pulled up by the FFS monitor, %lld us after request",
+          (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - pending->requested).count());
+  }
+
+  reportFunctions(*pending, status);
+  mSwitchLatency.mark(kStageCallback, pending->switchId);
+  mSwitchLatency.end(status == Status::SUCCESS, pending->switchId);
+}
+
+void UsbGadget::pendingTimeoutLoop() {
+  std::unique_lock<std::mutex> lock(mPendingLock);
+
+  while (true) {
+    if (!mPending) {
+      mPendingCV.wait(lock);
+      continue;
+    }
+
+    if (std::chrono::steady_clock::now() < mPending->deadline) {
+      mPendingCV.wait_until(lock, mPending->deadline);
+      continue;
+    }
+
+    PendingFunctions expired = std::move(*mPending);
+    mPending.reset();
+    lock.unlock();
+
+    ALOGE("FFS functions not ready in time, transaction %lld",
+          (long long)expired.transactionId);
+    reportFunctions(expired, Status::ERROR);
+    mSwitchLatency.end(false, expired.switchId);
+    lock.lock();
+  }
+}
+
 Status UsbGadget::setupFunctions(
     int64_t functions, const shared_ptr<IUsbGadgetCallback> &callback,
     int64_t timeout, int64_t in_transactionId) {
   bool ffsEnabled = false;
   int i = 0;
-  std::string gadgetName = GetProperty(USB_CONTROLLER_PROP, "");
-  std::string vendorProp = GetProperty(VENDOR_USB_PROP, GetProperty(PERSIST_VENDOR_USB_PROP, ""));
-  std::string vendorExtraProp = GetProperty(PERSIST_VENDOR_USB_EXTRA_PROP, "none");
+  std::string gadgetName = usbProperties.get(USB_CONTROLLER_PROP);
+  FunctionSet vendorKey;
 
   if (gadgetName.empty()) {
     ALOGE("UDC name not defined");
     return Status::ERROR;
   }
 
-  if (((functions & GadgetFunction::RNDIS) != 0) ||
-       ((functions & GadgetFunction::NCM) != 0)) {
-    ALOGI("setCurrentUsbFunctions rndis");
-    std::string tetherComp = (functions & GadgetFunction::RNDIS) ? "rndis" : "ncm";
-
-    if (vendorExtraProp != "none")
-      tetherComp += "," + vendorExtraProp;
-
-    if (functions & GadgetFunction::ADB)
-      tetherComp += ",adb";
+  if (vendorCompositionKey(functions, &vendorKey)) {
+    // look up the composition and link each function into it
+    if (addVendorFunctions(vendorKey, ffsEnabled, i)) {
+      if (functions != static_cast<uint64_t>(GadgetFunction::ADB))
+        return Status::ERROR;
 
-    if (addFunctionsFromPropString(tetherComp, ffsEnabled, i))
-      return Status::ERROR;
-  } else if (functions == static_cast<uint64_t>(GadgetFunction::ADB) &&
-      !vendorProp.empty() && vendorProp != "adb") {
-    // override adb-only with additional QTI functions if vendor.usb.config
-    // or persist.vendor.usb.config is set
-
-    // tack on ADB to the property string if not there, since we only arrive
-    // here if "USB debugging enabled" is chosen which implies ADB
-    if (vendorProp.find("adb") == std::string::npos)
-      vendorProp += ",adb";
-
-    ALOGI("setting composition from %s: %s", VENDOR_USB_PROP,
-            vendorProp.c_str());
-
-    // look up & parse prop string and link each function into the composition
-    if (addFunctionsFromPropString(vendorProp, ffsEnabled, i)) {
-      // if failed just fall back to adb-only
-      unlinkFunctions(CONFIG_PATH);
+      // if the vendor.usb.config override failed just fall back to adb-only
+      unlinkAllFunctions();
       i = 0;
       ffsEnabled = true;
-      if (addAdb(&mMonitorFfs, &i) != ::android::hardware::usb::gadget::V1_0::Status::SUCCESS)
+      if (linkAdb(mMonitorFfs, i) != ConfigfsStatus::SUCCESS)
         return Status::ERROR;
     }
   } else { // standard Android supported functions
-    WriteStringToFile("android", CONFIG_STRING);
+    WriteStringToFile("android", fsPath(CONFIG_STRING));
 
-    if (addGenericAndroidFunctions(&mMonitorFfs, functions, &ffsEnabled, &i)
-              != ::android::hardware::usb::gadget::V1_0::Status::SUCCESS)
+    if (linkAndroidFunctions(mMonitorFfs, functions, ffsEnabled, i)
+              != ConfigfsStatus::SUCCESS)
       return Status::ERROR;
 
     if ((functions & GadgetFunction::ADB) != 0) {
       ffsEnabled = true;
-      if (addAdb(&mMonitorFfs, &i) != ::android::hardware::usb::gadget::V1_0::Status::SUCCESS)
+      if (linkAdb(mMonitorFfs, i) != ConfigfsStatus::SUCCESS)
         return Status::ERROR;
     }
   }
 
+  mSwitchLatency.mark(kStageLink);
+
   if (functions & (GadgetFunction::ADB | GadgetFunction::MTP | GadgetFunction::PTP)) {
-    if (symlink(CONFIG_PATH, OS_DESC_PATH)) {
+    if (symlink(fsPath(CONFIG_PATH).c_str(), fsPath(OS_DESC_PATH).c_str())) {
       ALOGE("Cannot create symlink %s -> %s errno:%d", CONFIG_PATH, OS_DESC_PATH, errno);
       return Status::ERROR;
     }
   }
+  mSwitchLatency.mark(kStageOsDesc);
 
   // Pull up the gadget right away when there are no ffs functions.
   if (!ffsEnabled) {
-    if (!WriteStringToFile(gadgetName, PULLUP_PATH)) return Status::ERROR;
+    if (!WriteStringToFile(gadgetName, fsPath(PULLUP_PATH))) return Status::ERROR;
+    mSwitchLatency.mark(kStagePullup);
     mCurrentUsbFunctionsApplied = true;
     if (callback)
       callback->setCurrentUsbFunctionsCb(functions, Status::SUCCESS,
                       in_transactionId);
+    mSwitchLatency.mark(kStageCallback);
+    mSwitchLatency.end(true);
     ALOGI("Gadget pullup without FFS fuctions");
+    watchEnumeration();
     return Status::SUCCESS;
   }
 
-  // Monitors the ffs paths to pull up the gadget when descriptors are written.
-  // Also takes of the pulling up the gadget again if the userspace process
-  // dies and restarts.
-  mMonitorFfs.registerFunctionsAppliedCallback(
-      [](bool functionsApplied, void *payload) {
-        ((UsbGadget*)payload)->mCurrentUsbFunctionsApplied = functionsApplied;
-      }, this);
-  mMonitorFfs.startMonitor();
+  startFfsMonitor(functions, callback, timeout, in_transactionId);
+  return Status::SUCCESS;
+}
 
-  ALOGI("Started monitor for FFS functions");
+/*
+ * Work out the gadget layout for functions without touching configfs,
+ * mirroring setupFunctions(). Returns false for compositions that are
+ * left to the libusbconfigfs helpers (MIDI, accessory, audio source) or
+ * that setupFunctions() would reject, so they take the full teardown path.
+ */
+bool UsbGadget::planComposition(uint64_t functions, GadgetPlan &plan) {
+  FunctionSet vendorKey;
+
+  if (androidPid(functions) == 0)
+    return false;
+
+  if (vendorCompositionKey(functions, &vendorKey)) {
+    if (planVendorComposition(vendorKey, plan))
+      return false;
+  } else {
+    if (functions & ~static_cast<uint64_t>(GadgetFunction::ADB | GadgetFunction::MTP |
+                                           GadgetFunction::PTP))
+      return false;
+
+    plan.configuration = "android";
+    plan.vid = 0x18d1;
+    plan.pid = androidPid(functions);
+
+    if (functions & GadgetFunction::MTP) {
+      plan.functions.push_back("ffs.mtp");
+      plan.ffs.add(kFuncMtp);
+      plan.descUse = true;
+    } else if (functions & GadgetFunction::PTP) {
+      plan.functions.push_back("ffs.ptp");
+      plan.ffs.add(kFuncPtp);
+      plan.descUse = true;
+    }
 
-  if (callback) {
-    bool gadgetPullup = mMonitorFfs.waitForPullUp(timeout);
-    ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(
-        functions, gadgetPullup ? Status::SUCCESS : Status::ERROR,
-        in_transactionId);
-    if (!ret.isOk())
-      ALOGE("setCurrentUsbFunctionsCb error %s", ret.getDescription().c_str());
+    if (functions & GadgetFunction::ADB) {
+      plan.functions.push_back("ffs.adb");
+      plan.ffs.add(kFuncAdb);
+    }
+  }
+
+  plan.osDesc = functions & (GadgetFunction::ADB | GadgetFunction::MTP | GadgetFunction::PTP);
+  return true;
+}
+
+/*
+ * planComposition() for functions, memoized while the property snapshot it
+ * depends on is unchanged. nullptr if functions cannot be planned.
+ */
+const GadgetPlan *UsbGadget::cachedPlan(uint64_t functions) {
+  uint64_t generation = usbProperties.generation();
+
+  if (generation != mPlanCacheGeneration) {
+    mPlanCache.clear();
+    mPlanCacheGeneration = generation;
+  }
+
+  auto it = mPlanCache.find(functions);
+  if (it == mPlanCache.end()) {
+    GadgetPlan plan;
+
+    if (planComposition(functions, plan))
+      it = mPlanCache.emplace(functions, std::move(plan)).first;
+    else
+      it = mPlanCache.emplace(functions, std::nullopt).first;
+  }
+
+  return it->second ? &*it->second : nullptr;
+}
+
+/*
+ * The function links of configs/b.1 ordered by their functionN index,
+ * which is the order they were linked in and hence the interface order.
+ * Fails on links not made by linkFunction(), such as the fN links of the
+ * init compositions, since their order cannot be told from the names.
+ */
+static bool readLinkedFunctions(std::vector<std::pair<std::string, std::string>> &links) {
+  std::string configPath = fsPath(CONFIG_PATH);
+  std::map<long, std::pair<std::string, std::string>> ordered;
+  DIR *dir = opendir(configPath.c_str());
+  struct stat st;
+
+  if (dir == NULL)
+    return false;
+
+  struct dirent *entry;
+  bool ok = true;
+  while ((entry = readdir(dir))) {
+    // d_type is not reliable on configfs
+    if (lstat((configPath + entry->d_name).c_str(), &st) || !S_ISLNK(st.st_mode))
+      continue;
+
+    if (strncmp(entry->d_name, FUNCTION_NAME, strlen(FUNCTION_NAME))) {
+      ok = false;
+      break;
+    }
+
+    const char *index = entry->d_name + strlen(FUNCTION_NAME);
+    char *end;
+    long n = strtol(index, &end, 10);
+    char target[PATH_MAX];
+    ssize_t len = readlink((configPath + entry->d_name).c_str(), target, sizeof(target) - 1);
+
+    if (*index == '\0' || *end != '\0' || len < 0 || ordered.count(n)) {
+      ok = false;
+      break;
+    }
+
+    target[len] = '\0';
+    const char *name = strrchr(target, '/');
+    ordered[n] = { entry->d_name, name ? name + 1 : target };
+  }
+  closedir(dir);
+
+  for (auto & [n, link] : ordered)
+    links.push_back(link);
+
+  return ok;
+}
+
+// The controller the gadget is bound to, empty while it is pulled down
+static std::string boundUdc() {
+  std::string udc;
+
+  if (!ReadFileToString(fsPath(PULLUP_PATH), &udc))
+    return "";
+
+  return Trim(udc);
+}
+
+/*
+ * Bring configfs from whatever is linked in configs/b.1 to plan with as
+ * few configfs operations as possible: links shared with the new
+ * composition as a common prefix are kept, and VID/PID, os_desc and the
+ * configuration string are only rewritten when they change. The UDC is
+ * left alone.
+ */
+Status UsbGadget::stagePlan(const GadgetPlan &plan) {
+  std::vector<std::pair<std::string, std::string>> links;
+  // configfs still holds what mAppliedPlan wrote, so equal values are skipped
+  bool knownState = mPlanApplied;
+  bool sameVidPid = knownState && mAppliedPlan.vid == plan.vid &&
+      mAppliedPlan.pid == plan.pid;
+  size_t keep = 0;
+  struct stat st;
+
+  // e.g. set up by init before the HAL started
+  if (!knownState) {
+    std::string vid, pid;
+
+    sameVidPid = ReadFileToString(fsPath(VENDOR_ID_PATH), &vid) &&
+        ReadFileToString(fsPath(PRODUCT_ID_PATH), &pid) &&
+        strtoul(vid.c_str(), nullptr, 16) == plan.vid &&
+        strtoul(pid.c_str(), nullptr, 16) == plan.pid;
+  }
+
+  // Any failure past this point leaves configfs in an unknown state
+  mPlanApplied = false;
+
+  if (!readLinkedFunctions(links)) {
+    ALOGI("Current composition not linked by the HAL, relinking all functions");
+    if (!unlinkAllFunctions())
+      return Status::ERROR;
+    links.clear();
+  }
+
+  // resetGadget() clears these on the full teardown path; no plan sets them
+  if (!knownState &&
+      (!WriteStringToFile("0", fsPath(DEVICE_CLASS_PATH)) ||
+       !WriteStringToFile("0", fsPath(DEVICE_SUB_CLASS_PATH)) ||
+       !WriteStringToFile("0", fsPath(DEVICE_PROTOCOL_PATH))))
+    return Status::ERROR;
+
+  while (keep < links.size() && keep < plan.functions.size() &&
+         links[keep].second == plan.functions[keep])
+    keep++;
+
+  for (size_t i = keep; i < links.size(); i++) {
+    if (unlink((fsPath(CONFIG_PATH) + links[i].first).c_str())) {
+      ALOGE("Unable to unlink %s errno:%d", links[i].first.c_str(), errno);
+      return Status::ERROR;
+    }
+  }
+
+  ALOGI("Composition %s: kept %zu, unlinked %zu, linking %zu functions",
+        plan.configuration.c_str(), keep, links.size() - keep, plan.functions.size() - keep);
+
+  bool osDescLinked = lstat(fsPath(OS_DESC_PATH).c_str(), &st) == 0;
+  if (osDescLinked && !plan.osDesc) {
+    if (remove(fsPath(OS_DESC_PATH).c_str()))
+      ALOGI("Unable to remove file %s errno:%d", OS_DESC_PATH, errno);
   }
 
+  if ((!knownState || mAppliedPlan.descUse != plan.descUse) &&
+      !WriteStringToFile(plan.descUse ? "1" : "0", fsPath(DESC_USE_PATH)))
+    return Status::ERROR;
+
+  if (!knownState || mAppliedPlan.configuration != plan.configuration)
+    WriteStringToFile(plan.configuration, fsPath(CONFIG_STRING));
+
+  for (auto & [attribute, value] : plan.attributes)
+    WriteStringToFile(value, fsPath(FUNCTIONS_PATH) + attribute);
+
+  for (size_t i = keep; i < plan.functions.size(); i++) {
+    if (linkFunction(plan.functions[i].c_str(), i))
+      return Status::ERROR;
+
+    if (i == 0 && plan.diagPid)
+      WriteStringToFile(StringPrintf("0x%04x", plan.pid), fsPath(FUNCTIONS_PATH "diag.diag/pid"));
+  }
+  mSwitchLatency.mark(kStageLink);
+
+  if (!sameVidPid &&
+      setVidPid(StringPrintf("0x%04x", plan.vid).c_str(),
+                StringPrintf("0x%04x", plan.pid).c_str()) !=
+          ConfigfsStatus::SUCCESS)
+    return Status::ERROR;
+  mSwitchLatency.mark(kStageVidPid);
+
+  if (plan.osDesc && !osDescLinked) {
+    if (symlink(fsPath(CONFIG_PATH).c_str(), fsPath(OS_DESC_PATH).c_str())) {
+      ALOGE("Cannot create symlink %s -> %s errno:%d", CONFIG_PATH, OS_DESC_PATH, errno);
+      return Status::ERROR;
+    }
+  }
+  mSwitchLatency.mark(kStageOsDesc);
+
+  mAppliedPlan = plan;
+  mPlanApplied = true;
   return Status::SUCCESS;
 }
 
+/*
+ * Switch the gadget to plan: stage it with stagePlan() and pull the gadget
+ * back up, restarting the FFS monitor only when the set of FunctionFS
+ * instances changes. A bound gadget is pulled down for kDisconnectWaitUs
+ * so the host sees the disconnect, and configfs is updated within that
+ * window. A gadget that is not bound, as on the first request after boot,
+ * has no host to notify and is not held down.
+ */
+Status UsbGadget::applyPlan(const GadgetPlan &plan, uint64_t functions,
+                            const shared_ptr<IUsbGadgetCallback> &callback,
+                            int64_t timeout, int64_t in_transactionId) {
+  auto pulledDown = std::chrono::steady_clock::now();
+  std::string gadgetName = usbProperties.get(USB_CONTROLLER_PROP);
+  bool restartMonitor = !mPlanApplied || !plan.ffs.sameMembers(mAppliedPlan.ffs) ||
+      (!plan.ffs.empty() && !mMonitorFfs.isMonitorRunning());
+  bool bound = !boundUdc().empty();
+  Status status;
+
+  if (gadgetName.empty()) {
+    ALOGE("UDC name not defined");
+    return Status::ERROR;
+  }
+
+  if (restartMonitor && mMonitorFfs.isMonitorRunning())
+    mMonitorFfs.reset();
+
+  if (bound && !WriteStringToFile("none", fsPath(PULLUP_PATH)))
+    ALOGI("Gadget cannot be pulled down");
+  mSwitchLatency.mark(kStageTeardown);
+
+  status = stagePlan(plan);
+  if (status != Status::SUCCESS)
+    return status;
+
+  if (restartMonitor) {
+    for (uint8_t instance : plan.ffs) {
+      if (!watchFfs(mMonitorFfs, (UsbFunctionId)instance))
+        return Status::ERROR;
+    }
+    mSwitchLatency.mark(kStageFfsMonitor);
+  }
+
+  // Leave the gadget pulled down to give time for the host to sense disconnect.
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - pulledDown).count();
+  if (bound && elapsed < kDisconnectWaitUs)
+    usleep(kDisconnectWaitUs - elapsed);
+  mSwitchLatency.mark(kStageDisconnectWait);
+
+  // Pull up the gadget right away when there are no ffs functions.
+  if (plan.ffs.empty()) {
+    if (!WriteStringToFile(gadgetName, fsPath(PULLUP_PATH)))
+      return Status::ERROR;
+    mSwitchLatency.mark(kStagePullup);
+
+    mCurrentUsbFunctionsApplied = true;
+    if (callback)
+      callback->setCurrentUsbFunctionsCb(functions, Status::SUCCESS, in_transactionId);
+    mSwitchLatency.mark(kStageCallback);
+    mSwitchLatency.end(true);
+    ALOGI("Gadget pullup without FFS functions, %lld us after request",
+          (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - mRequestStart).count());
+    watchEnumeration();
+    return Status::SUCCESS;
+  }
+
+  if (restartMonitor) {
+    startFfsMonitor(functions, callback, timeout, in_transactionId);
+    return Status::SUCCESS;
+  }
+
+  /*
+   * The running monitor pulls the gadget up once the FFS daemons have
+   * re-enabled their endpoints after the unbind, and completes the request
+   * as for a new monitor. Daemons that kept their endpoints never trigger
+   * it, so try the pullup here too; it fails until the endpoints are ready.
+   */
+  setPending(functions, callback, timeout, in_transactionId);
+  if (WriteStringToFile(gadgetName, fsPath(PULLUP_PATH)) || boundUdc() == gadgetName)
+    functionsApplied(true);
+  return Status::SUCCESS;
+}
+
+/*
+ * Link the composition applied before the last shutdown while the gadget
+ * is not bound yet, so that the framework's first request after boot finds
+ * configfs already matching and only has to pull the gadget up.
+ */
+void UsbGadget::stageLastFunctions() {
+  std::string last = GetProperty(PERSIST_GADGET_FUNCTIONS_PROP, "");
+  auto start = std::chrono::steady_clock::now();
+  const GadgetPlan *plan;
+
+  if (!ParseUint(last, &mPersistedFunctions) || !boundUdc().empty() ||
+      (plan = cachedPlan(mPersistedFunctions)) == nullptr)
+    return;
+
+  if (stagePlan(*plan) != Status::SUCCESS) {
+    ALOGI("Unable to stage last composition %s", plan->configuration.c_str());
+    return;
+  }
+
+  ALOGI("Staged last composition %s in %lld us", plan->configuration.c_str(),
+        (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+}
+
+// Remember functions for stageLastFunctions() on the next boot
+void UsbGadget::persistFunctions(uint64_t functions) {
+  if (functions == mPersistedFunctions)
+    return;
+
+  if (SetProperty(PERSIST_GADGET_FUNCTIONS_PROP, std::to_string(functions)))
+    mPersistedFunctions = functions;
+  else
+    ALOGE("Unable to set %s, boot staging stays off", PERSIST_GADGET_FUNCTIONS_PROP);
+}
+
+/*
+ * Log the time from boot until the host first configures the gadget. The
+ * UDC core notifies pollers of the state attribute on every change.
+ */
+void UsbGadget::watchEnumeration() {
+  if (mEnumerationWatched.exchange(true))
+    return;
+
+  std::string statePath = fsPath("/sys/class/udc/") + usbProperties.get(USB_CONTROLLER_PROP) +
+      "/state";
+
+  std::thread([statePath]() {
+    SysfsAttr state(statePath);
+    auto start = std::chrono::steady_clock::now();
+    char buf[32];
+
+    while (std::chrono::steady_clock::now() - start < kEnumerationWatchTime) {
+      if (state.read(buf, sizeof(buf)) < 0)
+        break;
+
+      if (!strcmp(buf, "configured")) {
+        ALOGI("Gadget enumerated %lld ms after boot",
+              (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                  boot_clock::now().time_since_epoch()).count());
+        return;
+      }
+
+      state.waitForChange(1000);
+    }
+
+    ALOGI("Gadget not enumerated by a host");
+  }).detach();
+}
+
 ScopedAStatus UsbGadget::setCurrentUsbFunctions(int64_t functions,
                 const shared_ptr<IUsbGadgetCallback> &callback,
                 int64_t timeout, int64_t in_transactionId) {
   std::unique_lock<std::mutex> lk(mLockSetCurrentFunction);
 
+  const GadgetPlan *plan;
+  Status status;
+
+  mRequestStart = std::chrono::steady_clock::now();
+
+  // A request still waiting for its FFS daemons is superseded by this one
+  completePending(Status::FUNCTIONS_NOT_APPLIED);
+  mSwitchId = mSwitchLatency.begin(functions);
+
   mCurrentUsbFunctions = functions;
   mCurrentUsbFunctionsApplied = false;
 
+  plan = functions != static_cast<uint64_t>(GadgetFunction::NONE) ? cachedPlan(functions) : nullptr;
+  mSwitchLatency.mark(kStagePlan);
+
+  if (plan != nullptr) {
+    status = applyPlan(*plan, functions, callback, timeout, in_transactionId);
+    if (status != Status::SUCCESS)
+      goto error;
+
+    persistFunctions(functions);
+    ALOGI("Usb Gadget setcurrent functions called successfully");
+    return ScopedAStatus::ok();
+  }
+
   // Unlink the gadget and stop the monitor if running.
-  Status status = tearDownGadget();
+  mPlanApplied = false;
+  status = tearDownGadget();
   if (status != Status::SUCCESS) {
     goto error;
   }
+  mSwitchLatency.mark(kStageTeardown);
 
   // Leave the gadget pulled down to give time for the host to sense disconnect.
   usleep(kDisconnectWaitUs);
+  mSwitchLatency.mark(kStageDisconnectWait);
 
   if (functions == static_cast<uint64_t>(GadgetFunction::NONE)) {
-    if (callback == nullptr)
+    if (callback == nullptr) {
+      mSwitchLatency.end(false);
       return ScopedAStatus::fromExceptionCode(EX_NULL_POINTER);
+    }
     ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(functions,
                     Status::SUCCESS,
                     in_transactionId);
+    mSwitchLatency.mark(kStageCallback);
+    mSwitchLatency.end(true);
     if (!ret.isOk())
       ALOGE("Error while calling setCurrentUsbFunctionsCb %s",
             ret.getDescription().c_str());
@@ -482,16 +1175,20 @@ ScopedAStatus UsbGadget::setCurrentUsbFunctions(int64_t functions,
   if (status != Status::SUCCESS) {
     goto error;
   }
+  mSwitchLatency.mark(kStageVidPid);
 
   status = setupFunctions(functions, callback, timeout, in_transactionId);
   if (status != Status::SUCCESS) {
     goto error;
   }
 
+  persistFunctions(functions);
+
   ALOGI("Usb Gadget setcurrent functions called successfully");
   return ScopedAStatus::ok();
 
 error:
+  mSwitchLatency.end(false);
   ALOGI("Usb Gadget setcurrent functions failed");
   if (callback == nullptr)
     return ScopedAStatus::fromServiceSpecificErrorWithMessage(-1,
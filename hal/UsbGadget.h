@@ -29,7 +29,18 @@
 #include <aidl/android/hardware/usb/gadget/GadgetFunction.h>
 #include <aidl/android/hardware/usb/gadget/IUsbGadget.h>
 #include <aidl/android/hardware/usb/gadget/IUsbGadgetCallback.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "UsbFunctions.h"
+#include "UsbSwitchLatency.h"
+#include "UsbSysfs.h"
 
 namespace aidl {
 namespace android {
@@ -47,6 +58,38 @@ using ::android::hardware::usb::gadget::MonitorFfs;
 using ::ndk::ScopedAStatus;
 using ::std::shared_ptr;
 
+// Target state of the configfs gadget for a composition
+struct GadgetPlan {
+  // function directory names, in configs/b.1 link order
+  std::vector<std::string> functions;
+  // FunctionFS instances among functions whose endpoints gate the pullup
+  FunctionSet ffs;
+  // strings/0x409/configuration
+  std::string configuration;
+  uint16_t vid = 0;
+  uint16_t pid = 0;
+  // write pid to diag.diag/pid for QC DLOAD mode
+  bool diagPid = false;
+  // function attributes written before linking: path under functions/, value
+  std::vector<std::pair<std::string, std::string>> attributes;
+  // os_desc/b.1 linked to the configuration
+  bool osDesc = false;
+  // os_desc/use
+  bool descUse = false;
+};
+
+// A setCurrentUsbFunctions() request waiting for its FunctionFS daemons
+struct PendingFunctions {
+  uint64_t functions;
+  shared_ptr<IUsbGadgetCallback> callback;
+  int64_t transactionId;
+  std::chrono::steady_clock::time_point requested;
+  // ERROR is reported if the gadget is not pulled up by then
+  std::chrono::steady_clock::time_point deadline;
+  // SwitchLatency id of the request
+  uint64_t switchId;
+};
+
 struct UsbGadget : public BnUsbGadget {
   UsbGadget(const char* const gadget);
 
@@ -63,12 +106,30 @@ struct UsbGadget : public BnUsbGadget {
   ScopedAStatus getUsbSpeed(const shared_ptr<IUsbGadgetCallback> &callback,
 	    int64_t in_transactionId) override;
 
+  binder_status_t dump(int fd, const char **args, uint32_t numArgs) override;
+
 private:
   Status tearDownGadget();
   Status setupFunctions(int64_t functions,
                         const shared_ptr<IUsbGadgetCallback> &callback,
                         int64_t timeout, int64_t in_transactionId);
-  int addFunctionsFromPropString(std::string prop, bool &ffsEnabled, int &i);
+  int addVendorFunctions(const FunctionSet &key, bool &ffsEnabled, int &i);
+  bool planComposition(uint64_t functions, GadgetPlan &plan);
+  const GadgetPlan *cachedPlan(uint64_t functions);
+  Status stagePlan(const GadgetPlan &plan);
+  Status applyPlan(const GadgetPlan &plan, uint64_t functions,
+                   const shared_ptr<IUsbGadgetCallback> &callback,
+                   int64_t timeout, int64_t in_transactionId);
+  void startFfsMonitor(uint64_t functions, const shared_ptr<IUsbGadgetCallback> &callback,
+                       int64_t timeout, int64_t in_transactionId);
+  void setPending(uint64_t functions, const shared_ptr<IUsbGadgetCallback> &callback,
+                  int64_t timeout, int64_t in_transactionId);
+  void functionsApplied(bool applied);
+  void completePending(Status status);
+  void pendingTimeoutLoop();
+  void stageLastFunctions();
+  void persistFunctions(uint64_t functions);
+  void watchEnumeration();
 
   MonitorFfs mMonitorFfs;
 
@@ -77,6 +138,36 @@ private:
 
   uint64_t mCurrentUsbFunctions;
   bool mCurrentUsbFunctionsApplied;
+
+  // Last plan applied through applyPlan(); invalid after a full teardown
+  GadgetPlan mAppliedPlan;
+  bool mPlanApplied;
+
+  // planComposition() results by functions, nullopt where it failed.
+  // Dropped when the property snapshot generation moves on.
+  std::map<uint64_t, std::optional<GadgetPlan>> mPlanCache;
+  uint64_t mPlanCacheGeneration;
+
+  // Last functions saved for the next boot
+  uint64_t mPersistedFunctions;
+  // Boot to enumeration time is logged once, after the first pullup
+  std::atomic<bool> mEnumerationWatched;
+
+  // Start of the setCurrentUsbFunctions() request being applied
+  std::chrono::steady_clock::time_point mRequestStart;
+  // Stage timing of the recent requests
+  SwitchLatency mSwitchLatency;
+  uint64_t mSwitchId;
+
+  // Request completed from the FFS monitor's pullup or on its deadline,
+  // so that the binder thread does not wait for the FFS daemons
+  std::optional<PendingFunctions> mPending;
+  // Protects mPending; mPendingCV wakes the deadline thread
+  std::mutex mPendingLock;
+  std::condition_variable mPendingCV;
+
+  // /sys/class/udc/<controller>/current_speed
+  SysfsAttr mUdcSpeed;
 };
 
 }  // namespace gadget
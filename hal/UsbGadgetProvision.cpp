@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * One-shot provisioning of the configfs gadget tree, run once from init on
+ * zygote-start in place of one init action per mkdir/chown/write. All
+ * paths are resolved relative to a single /config/usb_gadget dirfd, every
+ * step is attempted, and failures are reported together at the end.
+ *
+ * usage: usb_gadget_provision
+ */
+
+#define LOG_TAG "usb_gadget_provision"
+
+#include <android-base/properties.h>
+#include <android-base/unique_fd.h>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <iterator>
+#include <private/android_filesystem_config.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "UsbSysfs.h"
+
+using ::aidl::android::hardware::usb::fsPath;
+using ::android::base::GetBoolProperty;
+using ::android::base::GetProperty;
+using ::android::base::unique_fd;
+
+namespace {
+
+enum Op {
+  // mkdir 0770 system usb, fixing up mode and owner if it exists
+  MKDIR,
+  // chown system usb
+  CHOWN,
+  // write value
+  WRITE,
+  // write the value of the property named by value
+  WRITE_PROP,
+};
+
+struct Step {
+  Op op;
+  // relative to /config/usb_gadget
+  const char *path;
+  const char *value;
+};
+
+const Step kGadgetSteps[] = {
+  { CHOWN, "." },
+  { MKDIR, "g1" },
+  { CHOWN, "g1/UDC" },
+  { CHOWN, "g1/bDeviceClass" },
+  { CHOWN, "g1/bDeviceProtocol" },
+  { CHOWN, "g1/bDeviceSubClass" },
+  { CHOWN, "g1/bMaxPacketSize0" },
+  { CHOWN, "g1/bcdDevice" },
+  { CHOWN, "g1/bcdUSB" },
+  { CHOWN, "g1/configs" },
+  { CHOWN, "g1/functions" },
+  { CHOWN, "g1/idProduct" },
+  { CHOWN, "g1/idVendor" },
+  { CHOWN, "g1/max_speed" },
+  { CHOWN, "g1/os_desc" },
+  { CHOWN, "g1/strings" },
+  { MKDIR, "g1/strings/0x409" },
+  { CHOWN, "g1/strings/0x409/manufacturer" },
+  { CHOWN, "g1/strings/0x409/product" },
+  { CHOWN, "g1/strings/0x409/serialnumber" },
+  { MKDIR, "g1/functions/mass_storage.0" },
+  { MKDIR, "g1/functions/mtp.gs0" },
+  { MKDIR, "g1/functions/ptp.gs1" },
+  { MKDIR, "g1/functions/accessory.gs2" },
+  { MKDIR, "g1/functions/audio_source.gs3" },
+  { MKDIR, "g1/functions/midi.gs5" },
+  { CHOWN, "g1/functions/midi.gs5/buflen" },
+  { CHOWN, "g1/functions/midi.gs5/id" },
+  { CHOWN, "g1/functions/midi.gs5/in_ports" },
+  { CHOWN, "g1/functions/midi.gs5/index" },
+  { CHOWN, "g1/functions/midi.gs5/out_ports" },
+  { CHOWN, "g1/functions/midi.gs5/qlen" },
+  { MKDIR, "g1/functions/ffs.adb" },
+  { MKDIR, "g1/functions/ffs.diag" },
+  { MKDIR, "g1/functions/ffs.diag_mdm" },
+  { MKDIR, "g1/functions/ffs.diag_mdm2" },
+  { MKDIR, "g1/functions/diag.diag" },
+  { MKDIR, "g1/functions/diag.diag_mdm" },
+  { MKDIR, "g1/functions/diag.diag_mdm2" },
+  { MKDIR, "g1/functions/cser.dun.0" },
+  { MKDIR, "g1/functions/cser.nmea.1" },
+  { MKDIR, "g1/functions/cser.dun.2" },
+  { MKDIR, "g1/functions/gsi.rmnet" },
+  { MKDIR, "g1/functions/gsi.rndis" },
+  { MKDIR, "g1/functions/gsi.dpl" },
+  { MKDIR, "g1/functions/qdss.qdss" },
+  { MKDIR, "g1/functions/qdss.qdss_mdm" },
+  { MKDIR, "g1/functions/qdss.qdss_sw" },
+  { CHOWN, "g1/functions/qdss.qdss/enable_debug_inface" },
+  { CHOWN, "g1/functions/qdss.qdss_mdm/enable_debug_inface" },
+  { CHOWN, "g1/functions/qdss.qdss_sw/enable_debug_inface" },
+  { MKDIR, "g1/functions/rndis_bam.rndis" },
+  { MKDIR, "g1/functions/rndis.rndis" },
+  { MKDIR, "g1/functions/rmnet_bam.rmnet" },
+  { MKDIR, "g1/functions/rmnet_bam.dpl" },
+  { MKDIR, "g1/functions/rmnet_bam.rmnet_bam_dmux" },
+  { MKDIR, "g1/functions/rmnet_bam.dpl_bam_dmux" },
+  { MKDIR, "g1/functions/ncm.gs6" },
+  { CHOWN, "g1/functions/ncm.gs6/host_addr" },
+  { CHOWN, "g1/functions/ncm.gs6/ifname" },
+  { CHOWN, "g1/functions/ncm.gs6/os_desc" },
+  { CHOWN, "g1/functions/ncm.gs6/dev_addr" },
+  { CHOWN, "g1/functions/ncm.gs6/os_desc/interface.ncm" },
+  { CHOWN, "g1/functions/ncm.gs6/os_desc/interface.ncm/compatible_id" },
+  { CHOWN, "g1/functions/ncm.gs6/os_desc/interface.ncm/sub_compatible_id" },
+  { CHOWN, "g1/functions/ncm.gs6/qmult" },
+  { MKDIR, "g1/functions/ccid.ccid" },
+  { MKDIR, "g1/functions/uac2.0" },
+  { MKDIR, "g1/functions/uvc.0" },
+  { MKDIR, "g1/configs/b.1" },
+  { CHOWN, "g1/configs/b.1/MaxPower" },
+  { CHOWN, "g1/configs/b.1/bmAttributes" },
+  { CHOWN, "g1/configs/b.1/strings" },
+  { CHOWN, "g1/os_desc/b.1" },
+  { CHOWN, "g1/os_desc/b_vendor_code" },
+  { CHOWN, "g1/os_desc/qw_sign" },
+  { CHOWN, "g1/os_desc/use" },
+  { MKDIR, "g1/configs/b.1/strings/0x409" },
+  { CHOWN, "g1/configs/b.1/strings/0x409/configuration" },
+
+  // Create second ConfigFS gadget instance for dual-device configuration
+  { MKDIR, "g2" },
+  { MKDIR, "g2/strings/0x409" },
+  { MKDIR, "g2/configs/b.1" },
+  { MKDIR, "g2/configs/b.1/strings/0x409" },
+  { CHOWN, "g2/configs/b.1/strings/0x409/configuration" },
+  { CHOWN, "g2/UDC" },
+  { CHOWN, "g2/bDeviceClass" },
+  { CHOWN, "g2/bDeviceProtocol" },
+  { CHOWN, "g2/bDeviceSubClass" },
+  { CHOWN, "g2/bMaxPacketSize0" },
+  { CHOWN, "g2/bcdDevice" },
+  { CHOWN, "g2/bcdUSB" },
+  { CHOWN, "g2/configs" },
+  { CHOWN, "g2/functions" },
+  { CHOWN, "g2/idProduct" },
+  { CHOWN, "g2/idVendor" },
+  { CHOWN, "g2/max_speed" },
+  { CHOWN, "g2/os_desc" },
+  { CHOWN, "g2/strings" },
+
+  { WRITE, "g1/bcdUSB", "0x0200" },
+  { WRITE, "g2/bcdUSB", "0x0200" },
+  { WRITE_PROP, "g1/strings/0x409/serialnumber", "ro.serialno" },
+  { WRITE_PROP, "g2/strings/0x409/serialnumber", "ro.serialno" },
+  { WRITE_PROP, "g1/strings/0x409/manufacturer", "ro.product.manufacturer" },
+  { WRITE_PROP, "g2/strings/0x409/manufacturer", "ro.product.manufacturer" },
+  { WRITE, "g1/configs/b.1/MaxPower", "900" },
+  { WRITE, "g1/os_desc/use", "1" },
+  { WRITE, "g1/os_desc/b_vendor_code", "0x1" },
+  { WRITE, "g1/os_desc/qw_sign", "MSFT100" },
+  { WRITE, "g1/functions/rndis.rndis/class", "ef" },
+  { WRITE, "g1/functions/rndis.rndis/subclass", "4" },
+  { WRITE, "g1/functions/rndis.rndis/protocol", "1" },
+  { WRITE, "g1/functions/ncm.gs6/os_desc/interface.ncm/compatible_id", "WINNCM" },
+  { WRITE_PROP, "g1/functions/diag.diag/serial", "ro.serialno" },
+};
+
+// Only with vendor.usb.use_ffs_mtp=1
+const Step kFfsMtpSteps[] = {
+  { MKDIR, "g1/functions/ffs.mtp" },
+  { MKDIR, "g1/functions/ffs.ptp" },
+};
+
+// Failed steps, logged together once all steps have been tried
+struct Failures {
+  int count = 0;
+  std::string first;
+
+  void add(const Step &step, int err) {
+    if (count++ < 8)
+      first += std::string(first.empty() ? "" : ", ") + step.path + ": " + strerror(err);
+  }
+};
+
+bool writeAt(int dirfd, const char *path, const std::string &value) {
+  unique_fd fd(TEMP_FAILURE_RETRY(openat(dirfd, path, O_WRONLY | O_CLOEXEC)));
+
+  if (fd == -1)
+    return false;
+
+  return TEMP_FAILURE_RETRY(write(fd.get(), value.data(), value.size())) ==
+      (ssize_t)value.size();
+}
+
+void runSteps(int dirfd, const Step *steps, size_t count, Failures &failures) {
+  for (size_t i = 0; i < count; i++) {
+    const Step &step = steps[i];
+    bool ok = true;
+
+    switch (step.op) {
+      case MKDIR:
+        // configfs ignores the mode of mkdir, so set it like init does
+        ok = (mkdirat(dirfd, step.path, 0770) == 0 || errno == EEXIST) &&
+            fchmodat(dirfd, step.path, 0770, 0) == 0 &&
+            fchownat(dirfd, step.path, AID_SYSTEM, AID_USB, AT_SYMLINK_NOFOLLOW) == 0;
+        break;
+      case CHOWN:
+        ok = fchownat(dirfd, step.path, AID_SYSTEM, AID_USB, AT_SYMLINK_NOFOLLOW) == 0;
+        break;
+      case WRITE:
+        ok = writeAt(dirfd, step.path, step.value);
+        break;
+      case WRITE_PROP:
+        ok = writeAt(dirfd, step.path, GetProperty(step.value, ""));
+        break;
+    }
+
+    if (!ok)
+      failures.add(step, errno);
+  }
+}
+
+}  // namespace
+
+int main() {
+  auto start = std::chrono::steady_clock::now();
+  unique_fd dirfd(TEMP_FAILURE_RETRY(open(fsPath("/config/usb_gadget").c_str(),
+                                          O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+  Failures failures;
+
+  if (dirfd == -1) {
+    ALOGE("configfs not mounted errno:%d", errno);
+    return 1;
+  }
+
+  runSteps(dirfd.get(), kGadgetSteps, std::size(kGadgetSteps), failures);
+  if (GetBoolProperty("vendor.usb.use_ffs_mtp", false))
+    runSteps(dirfd.get(), kFfsMtpSteps, std::size(kFfsMtpSteps), failures);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  // Functions missing from the kernel fail here as they did under init
+  if (failures.count)
+    ALOGI("configfs gadget provisioned in %lld us, %d steps failed: %s%s", (long long)elapsed,
+          failures.count, failures.first.c_str(), failures.count > 8 ? ", ..." : "");
+  else
+    ALOGI("configfs gadget provisioned in %lld us", (long long)elapsed);
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG "android.hardware.usb.gadget-service.qti"
+
+#include <string.h>
+#include <thread>
+#include <utils/Log.h>
+
+#include "UsbProperties.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+PropertySnapshot::PropertySnapshot(std::initializer_list<const char *> names)
+    : mAreaSerial(0),
+      mGeneration(0) {
+  for (const char *name : names)
+    mEntries.push_back({ name, nullptr, UINT32_MAX, "" });
+}
+
+void PropertySnapshot::start() {
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    mAreaSerial = __system_property_area_serial();
+    refreshLocked();
+  }
+
+  std::thread(&PropertySnapshot::watch, this).detach();
+}
+
+/*
+ * Re-read the properties whose serial moved. Properties that do not exist
+ * yet are looked up again, since they may have been created since.
+ */
+void PropertySnapshot::refreshLocked() {
+  bool changed = false;
+
+  for (auto &entry : mEntries) {
+    if (entry.info == nullptr)
+      entry.info = __system_property_find(entry.name);
+
+    uint32_t serial = entry.info ? __system_property_serial(entry.info) : 0;
+    if (serial == entry.serial)
+      continue;
+
+    std::string value;
+    if (entry.info) {
+      __system_property_read_callback(entry.info,
+          [](void *cookie, const char *, const char *value, uint32_t) {
+            *(std::string *)cookie = value;
+          }, &value);
+    }
+
+    entry.serial = serial;
+    if (value != entry.value) {
+      entry.value = std::move(value);
+      changed = true;
+    }
+  }
+
+  if (changed)
+    mGeneration++;
+}
+
+void PropertySnapshot::syncLocked(uint32_t areaSerial) {
+  if (areaSerial == mAreaSerial)
+    return;
+
+  mAreaSerial = areaSerial;
+  refreshLocked();
+}
+
+void PropertySnapshot::watch() {
+  uint32_t serial;
+
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    serial = mAreaSerial;
+  }
+
+  // Wakes up for every property change in the system; a refresh of the
+  // watched entries is a handful of serial compares
+  while (__system_property_wait(nullptr, serial, &serial, nullptr)) {
+    std::lock_guard<std::mutex> lock(mLock);
+    syncLocked(serial);
+  }
+
+  ALOGE("property watcher exited");
+}
+
+std::string PropertySnapshot::get(const char *name, const std::string &defaultValue) {
+  std::lock_guard<std::mutex> lock(mLock);
+
+  syncLocked(__system_property_area_serial());
+
+  for (auto &entry : mEntries) {
+    if (!strcmp(entry.name, name))
+      return entry.value.empty() ? defaultValue : entry.value;
+  }
+
+  ALOGE("%s is not in the property snapshot", name);
+  return defaultValue;
+}
+
+uint64_t PropertySnapshot::generation() {
+  std::lock_guard<std::mutex> lock(mLock);
+
+  syncLocked(__system_property_area_serial());
+
+  return mGeneration;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBPROPERTIES_H
+#define ANDROID_HARDWARE_USB_QTI_USBPROPERTIES_H
+
+#include <initializer_list>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/system_properties.h>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Snapshot of a fixed set of system properties. Values are read once by
+ * start() and refreshed by a watcher thread woken by
+ * __system_property_wait() whenever any property changes, so get() only
+ * copies a cached string. Every refresh that changes a value bumps
+ * generation(), which lets callers cache values derived from the snapshot.
+ *
+ * The watcher may lag a property set made just before a request that
+ * depends on it (init sets vendor.usb.config, then sys.usb.config), so
+ * get() first compares the global property serial against the last one
+ * seen and refreshes inline if they differ.
+ */
+class PropertySnapshot {
+ public:
+  explicit PropertySnapshot(std::initializer_list<const char *> names);
+
+  // Read all properties and start the watcher
+  void start();
+
+  // Like GetProperty(): defaultValue if name is unset or empty
+  std::string get(const char *name, const std::string &defaultValue = "");
+  uint64_t generation();
+
+ private:
+  struct Entry {
+    const char *name;
+    const prop_info *info;
+    uint32_t serial;
+    std::string value;
+  };
+
+  void refreshLocked();
+  // Refresh if the global property serial moved past mAreaSerial
+  void syncLocked(uint32_t areaSerial);
+  void watch();
+
+  std::vector<Entry> mEntries;
+  // Global property serial at the last refresh
+  uint32_t mAreaSerial;
+  uint64_t mGeneration;
+  // Protects all of the above
+  std::mutex mLock;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBPROPERTIES_H
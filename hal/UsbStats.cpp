@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include <algorithm>
+#include <android-base/stringprintf.h>
+
+#include "UsbStats.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::StringAppendF;
+
+// Largest value counted in bucket
+static uint64_t bucketLimit(int bucket) {
+  return bucket ? (1ull << bucket) - 1 : 0;
+}
+
+uint64_t LatencyHistogram::count() const {
+  uint64_t count = 0;
+
+  for (auto &bucket : mBuckets)
+    count += bucket.load(std::memory_order_relaxed);
+  return count;
+}
+
+uint64_t LatencyHistogram::percentile(int p) const {
+  uint64_t total = count();
+  uint64_t rank = std::max<uint64_t>((total * p + 99) / 100, 1);
+  uint64_t seen = 0;
+
+  if (!total)
+    return 0;
+
+  for (int i = 0; i < kBuckets - 1; i++) {
+    seen += mBuckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank)
+      return std::min(bucketLimit(i), max());
+  }
+
+  return max();
+}
+
+std::string LatencyHistogram::toString(const char *unit) const {
+  uint64_t total = count();
+  std::string out;
+
+  if (!total)
+    return "n=0";
+
+  StringAppendF(&out, "n=%llu avg=%llu%s p50<=%llu%s p99<=%llu%s max=%llu%s",
+                (unsigned long long)total,
+                (unsigned long long)(mSum.load(std::memory_order_relaxed) / total), unit,
+                (unsigned long long)percentile(50), unit,
+                (unsigned long long)percentile(99), unit, (unsigned long long)max(), unit);
+
+  out += " [";
+  for (int i = 0, printed = 0; i < kBuckets; i++) {
+    uint64_t n = mBuckets[i].load(std::memory_order_relaxed);
+
+    if (n)
+      StringAppendF(&out, "%s%s%llu:%llu", printed++ ? " " : "",
+                    i == kBuckets - 1 ? ">" : "<=",
+                    (unsigned long long)bucketLimit(i == kBuckets - 1 ? i - 1 : i),
+                    (unsigned long long)n);
+  }
+  out += "]";
+
+  return out;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
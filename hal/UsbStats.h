@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBSTATS_H
+#define ANDROID_HARDWARE_USB_QTI_USBSTATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Power of two histogram of durations for dump(). Bucket 0 counts zero,
+ * bucket i values in [2^(i-1), 2^i) and the last one everything above.
+ * The unit is up to the caller.
+ *
+ * record() is a couple of relaxed atomic updates and is meant to be called
+ * from a single thread; readers on other threads see a consistent enough
+ * view without taking a lock.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int kBuckets = 28;
+
+  void record(uint64_t value) {
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    if (bucket >= kBuckets)
+      bucket = kBuckets - 1;
+
+    mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(value, std::memory_order_relaxed);
+    if (value > mMax.load(std::memory_order_relaxed))
+      mMax.store(value, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const;
+  uint64_t max() const { return mMax.load(std::memory_order_relaxed); }
+  // Largest value the bucket holding the p-th percentile can hold, capped
+  // at max()
+  uint64_t percentile(int p) const;
+
+  // "n=12 avg=40us p50<=63us p99<=511us max=301us" followed by the counts
+  // of the non-empty buckets, or "n=0"
+  std::string toString(const char *unit) const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> mBuckets = {};
+  std::atomic<uint64_t> mSum{0};
+  std::atomic<uint64_t> mMax{0};
+};
+
+/*
+ * std::unique_lock that records how long it held the mutex, in
+ * microseconds. The time is recorded before unlocking, so holders of the
+ * same mutex never update the histogram concurrently.
+ */
+class TimedLockGuard {
+ public:
+  TimedLockGuard(std::mutex &mutex, LatencyHistogram &holdUs)
+      : mLock(mutex), mHoldUs(holdUs), mStart(std::chrono::steady_clock::now()) {}
+  ~TimedLockGuard() {
+    if (mLock.owns_lock())
+      record();
+  }
+
+  void unlock() {
+    record();
+    mLock.unlock();
+  }
+
+ private:
+  void record() {
+    mHoldUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - mStart).count());
+  }
+
+  std::unique_lock<std::mutex> mLock;
+  LatencyHistogram &mHoldUs;
+  std::chrono::steady_clock::time_point mStart;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBSTATS_H
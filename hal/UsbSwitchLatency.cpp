@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include <aidl/android/hardware/usb/gadget/GadgetFunction.h>
+#include <algorithm>
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "UsbSwitchLatency.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::aidl::android::hardware::usb::gadget::GadgetFunction;
+using ::android::base::StringAppendF;
+
+static const char *const kStageNames[kStageCount] = {
+  "plan",
+  "teardown",
+  "disconnect_wait",
+  "vid_pid",
+  "link",
+  "os_desc",
+  "ffs_monitor",
+  "pullup",
+  "callback",
+};
+
+static std::string functionsName(uint64_t functions) {
+  static const std::pair<uint64_t, const char *> names[] = {
+    { GadgetFunction::MTP, "mtp" },
+    { GadgetFunction::PTP, "ptp" },
+    { GadgetFunction::RNDIS, "rndis" },
+    { GadgetFunction::NCM, "ncm" },
+    { GadgetFunction::MIDI, "midi" },
+    { GadgetFunction::ACCESSORY, "accessory" },
+    { GadgetFunction::AUDIO_SOURCE, "audio_source" },
+    { GadgetFunction::UVC, "uvc" },
+    { GadgetFunction::ADB, "adb" },
+  };
+  std::string name;
+
+  for (auto & [function, functionName] : names) {
+    if (functions & function)
+      name += std::string(name.empty() ? "" : ",") + functionName;
+  }
+
+  return name.empty() ? "none" : name;
+}
+
+// Nearest rank percentile; sorts values
+static uint32_t percentile(std::vector<uint32_t> &values, int p) {
+  if (values.empty())
+    return 0;
+
+  std::sort(values.begin(), values.end());
+  return values[std::max<size_t>((values.size() * p + 99) / 100, 1) - 1];
+}
+
+uint64_t SwitchLatency::begin(uint64_t functions) {
+  std::lock_guard<std::mutex> lock(mLock);
+
+  if (mOpen)
+    endLocked(false);
+
+  mOpen = true;
+  mCurrent = Record();
+  mCurrent.functions = functions;
+  mStart = mLastMark = Clock::now();
+  return ++mId;
+}
+
+void SwitchLatency::mark(SwitchStage stage, uint64_t id) {
+  std::lock_guard<std::mutex> lock(mLock);
+  Clock::time_point now = Clock::now();
+
+  if (!mOpen || (id != 0 && id != mId))
+    return;
+
+  // a stage may be entered more than once, e.g. linking in two steps
+  mCurrent.stageUs[stage] += std::chrono::duration_cast<std::chrono::microseconds>(
+      now - mLastMark).count();
+  mLastMark = now;
+}
+
+void SwitchLatency::end(bool success, uint64_t id) {
+  std::lock_guard<std::mutex> lock(mLock);
+
+  if (mOpen && (id == 0 || id == mId))
+    endLocked(success);
+}
+
+void SwitchLatency::endLocked(bool success) {
+  mCurrent.success = success;
+  mCurrent.totalUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - mStart).count();
+
+  mRing[mNext] = mCurrent;
+  mNext = (mNext + 1) % kSwitchHistory;
+  mCount = std::min(mCount + 1, kSwitchHistory);
+  mOpen = false;
+}
+
+void SwitchLatency::dump(int fd) {
+  std::vector<Record> records;
+  std::string out;
+
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    // oldest first
+    for (size_t i = 0; i < mCount; i++)
+      records.push_back(mRing[(mNext + kSwitchHistory - mCount + i) % kSwitchHistory]);
+  }
+
+  StringAppendF(&out, "Composition switches: last %zu (us)\n", records.size());
+
+  if (!records.empty()) {
+    std::vector<uint32_t> values;
+
+    StringAppendF(&out, "  %-16s %9s %9s %9s\n", "stage", "p50", "p99", "max");
+    for (int stage = 0; stage <= kStageCount; stage++) {
+      values.clear();
+      for (auto &record : records)
+        values.push_back(stage == kStageCount ? record.totalUs : record.stageUs[stage]);
+
+      uint32_t p50 = percentile(values, 50);
+      StringAppendF(&out, "  %-16s %9u %9u %9u\n",
+                    stage == kStageCount ? "total" : kStageNames[stage], p50,
+                    percentile(values, 99), values.back());
+    }
+
+    std::map<uint64_t, std::vector<const Record *>> byFunctions;
+    for (auto &record : records)
+      byFunctions[record.functions].push_back(&record);
+
+    StringAppendF(&out, "  %-24s %5s %6s %9s %9s  slowest stage p99, then stage=p50/p99\n",
+                  "composition", "count", "failed", "p50", "p99");
+    for (auto & [functions, switches] : byFunctions) {
+      int failed = 0;
+      int slowest = 0;
+      uint32_t slowestP99 = 0;
+
+      values.clear();
+      for (auto *record : switches) {
+        values.push_back(record->totalUs);
+        failed += !record->success;
+      }
+      uint32_t p50 = percentile(values, 50);
+      uint32_t p99 = percentile(values, 99);
+
+      for (int stage = 0; stage < kStageCount; stage++) {
+        values.clear();
+        for (auto *record : switches)
+          values.push_back(record->stageUs[stage]);
+
+        uint32_t stageP99 = percentile(values, 99);
+        if (stageP99 > slowestP99) {
+          slowest = stage;
+          slowestP99 = stageP99;
+        }
+      }
+
+      StringAppendF(&out, "  %-24s %5zu %6d %9u %9u  %s %u\n", functionsName(functions).c_str(),
+                    switches.size(), failed, p50, p99, kStageNames[slowest], slowestP99);
+
+      // p50/p99 of the stages this composition went through
+      out += "   ";
+      for (int stage = 0; stage < kStageCount; stage++) {
+        values.clear();
+        for (auto *record : switches)
+          values.push_back(record->stageUs[stage]);
+
+        uint32_t stageP99 = percentile(values, 99);
+        if (stageP99)
+          StringAppendF(&out, " %s=%u/%u", kStageNames[stage], percentile(values, 50), stageP99);
+      }
+      out += '\n';
+    }
+
+    StringAppendF(&out, "  recent:\n");
+    for (size_t i = records.size() > 8 ? records.size() - 8 : 0; i < records.size(); i++) {
+      const Record &record = records[i];
+
+      StringAppendF(&out, "    %-24s %s %9u:", functionsName(record.functions).c_str(),
+                    record.success ? "ok    " : "failed", record.totalUs);
+      for (int stage = 0; stage < kStageCount; stage++) {
+        if (record.stageUs[stage])
+          StringAppendF(&out, " %s=%u", kStageNames[stage], record.stageUs[stage]);
+      }
+      out += '\n';
+    }
+  }
+
+  ::android::base::WriteStringToFd(out, fd);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
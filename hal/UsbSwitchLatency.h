@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBSWITCHLATENCY_H
+#define ANDROID_HARDWARE_USB_QTI_USBSWITCHLATENCY_H
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Steps of a composition switch, in the order they normally run
+enum SwitchStage : uint8_t {
+  // composition lookup and plan cache
+  kStagePlan,
+  // full unlink and FFS monitor stop of the legacy path
+  kStageTeardown,
+  // gadget held down for the host to sense the disconnect
+  kStageDisconnectWait,
+  kStageVidPid,
+  // function links, attributes and the configuration string
+  kStageLink,
+  kStageOsDesc,
+  // FunctionFS endpoints registered with the monitor
+  kStageFfsMonitor,
+  // until the gadget is pulled up, by us or by the FFS monitor
+  kStagePullup,
+  // setCurrentUsbFunctionsCb() binder call
+  kStageCallback,
+  kStageCount,
+};
+
+/*
+ * Per stage timing of the last kSwitchHistory composition switches, for
+ * dump(). A switch is opened by begin(), each mark() charges the time
+ * since the previous mark to a stage, and end() files it in the ring.
+ * Marks outside of a switch, e.g. when staging at boot, are ignored.
+ *
+ * Thread safe: a switch is finished by the FFS monitor or deadline thread
+ * when FunctionFS daemons are involved.
+ */
+class SwitchLatency {
+ public:
+  static constexpr size_t kSwitchHistory = 64;
+
+  // Open a switch to functions; one still open is recorded as failed.
+  // Returns an id for end(), never 0.
+  uint64_t begin(uint64_t functions);
+  // Ignored unless switch id is still open, when id is set
+  void mark(SwitchStage stage, uint64_t id = 0);
+  // Close the open switch, only if it is still switch id when id is set
+  void end(bool success, uint64_t id = 0);
+
+  // Last switches, and p50/p99 per stage overall and per composition
+  void dump(int fd);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Record {
+    uint64_t functions = 0;
+    bool success = false;
+    uint32_t totalUs = 0;
+    std::array<uint32_t, kStageCount> stageUs = {};
+  };
+
+  void endLocked(bool success);
+
+  std::mutex mLock;
+  bool mOpen = false;
+  uint64_t mId = 0;
+  Record mCurrent;
+  Clock::time_point mStart;
+  Clock::time_point mLastMark;
+  std::array<Record, kSwitchHistory> mRing;
+  size_t mNext = 0;
+  size_t mCount = 0;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBSWITCHLATENCY_H
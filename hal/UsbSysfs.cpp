@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "UsbSysfs.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+std::string fsPath(std::string_view path) {
+  static const std::string root = [] {
+    const char *env = getenv("USB_HAL_FS_ROOT");
+    return std::string(env ? env : "");
+  }();
+
+  std::string prefixed;
+
+  prefixed.reserve(root.size() + path.size());
+  prefixed.append(root).append(path);
+  return prefixed;
+}
+
+SysfsStats &SysfsAttr::stats() {
+  static SysfsStats stats;
+
+  return stats;
+}
+
+void SysfsAttr::setPath(std::string path) {
+  mPath = std::move(path);
+  mFd.reset();
+}
+
+bool SysfsAttr::open() {
+  if (mPath.empty()) {
+    errno = ENOENT;
+    return false;
+  }
+
+  stats().opens++;
+  mFd.reset(TEMP_FAILURE_RETRY(::open(mPath.c_str(), O_RDONLY | O_CLOEXEC)));
+  return mFd != -1;
+}
+
+ssize_t SysfsAttr::read(char *buf, size_t len) {
+  ssize_t n = -1;
+
+  if (len == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (mFd == -1 && !open())
+      return -1;
+
+    stats().reads++;
+    n = TEMP_FAILURE_RETRY(pread(mFd.get(), buf, len - 1, 0));
+    if (n >= 0)
+      break;
+
+    // The kobject behind the fd is gone; the path may point to a new one
+    if (errno != ENODEV && errno != ENOENT && errno != EBADF)
+      return -1;
+    mFd.reset();
+  }
+
+  if (n < 0)
+    return -1;
+
+  while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+    n--;
+  buf[n] = '\0';
+
+  return n;
+}
+
+bool SysfsAttr::read(std::string *value) {
+  char buf[256];
+  ssize_t n = read(buf, sizeof(buf));
+
+  if (n < 0)
+    return false;
+
+  value->assign(buf, n);
+  return true;
+}
+
+bool SysfsAttr::waitForChange(int timeoutMs) {
+  if (mFd == -1 && !open())
+    return false;
+
+  struct pollfd pfd = { mFd.get(), POLLPRI, 0 };
+  return TEMP_FAILURE_RETRY(poll(&pfd, 1, timeoutMs)) > 0;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
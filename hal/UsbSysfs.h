@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBSYSFS_H
+#define ANDROID_HARDWARE_USB_QTI_USBSYSFS_H
+
+#include <android-base/unique_fd.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::unique_fd;
+
+// Syscalls issued through SysfsAttr, process wide
+struct SysfsStats {
+  std::atomic<uint64_t> opens{0};
+  std::atomic<uint64_t> reads{0};
+};
+
+/*
+ * Prefix an absolute sysfs or configfs path with the root directory named
+ * by the USB_HAL_FS_ROOT environment variable, so that the services can be
+ * run against a fake tree on a host. On device the variable is not set and
+ * the path is returned unchanged.
+ */
+std::string fsPath(std::string_view path);
+
+/*
+ * A sysfs attribute that is read often. The file is opened on first use
+ * and kept open; sysfs regenerates the value for every read at offset 0,
+ * so each read is a single pread() into the caller's buffer. When the
+ * device goes away (e.g. a Type-C partner is detached) the stale fd fails
+ * with ENODEV and the attribute is reopened once.
+ *
+ * Not thread safe; callers serialise access to an instance.
+ */
+class SysfsAttr {
+ public:
+  SysfsAttr() = default;
+  explicit SysfsAttr(std::string path) : mPath(std::move(path)) {}
+
+  const std::string &path() const { return mPath; }
+  // Point the attribute at another file, closing the current one
+  void setPath(std::string path);
+  void close() { mFd.reset(); }
+
+  // Read the value into buf, NUL terminated and without the trailing
+  // newline. Returns its length, or -1 with errno set.
+  ssize_t read(char *buf, size_t len);
+  bool read(std::string *value);
+
+  // Wait for sysfs_notify() on the attribute after a read; false on
+  // timeout or error. Only attributes the kernel notifies ever wake up.
+  bool waitForChange(int timeoutMs);
+
+  static SysfsStats &stats();
+
+ private:
+  bool open();
+
+  std::string mPath;
+  unique_fd mFd;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBSYSFS_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG "android.hardware.usb-service.qti"
+
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "UsbTimerQueue.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+TimerQueue::TimerQueue() : mNextId(1), mMaxLatenessUs(0), mFired(0) {
+  mTimerFd = unique_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+  if (mTimerFd == -1)
+    ALOGE("timerfd_create failed; errno=%d", errno);
+}
+
+uint64_t TimerQueue::schedule(std::chrono::milliseconds delay, Callback callback) {
+  uint64_t id = mNextId++;
+
+  mTimers.emplace(std::make_pair(Clock::now() + delay, id), std::move(callback));
+  arm();
+  return id;
+}
+
+void TimerQueue::cancel(uint64_t id) {
+  for (auto it = mTimers.begin(); it != mTimers.end(); ++it) {
+    if (it->first.second == id) {
+      mTimers.erase(it);
+      arm();
+      return;
+    }
+  }
+}
+
+void TimerQueue::clear() {
+  mTimers.clear();
+  arm();
+}
+
+void TimerQueue::run() {
+  uint64_t expirations;
+
+  if (read(mTimerFd.get(), &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    ALOGE("timerfd read failed; errno=%d", errno);
+
+  // Callbacks may schedule or cancel timers, so look up the head each time
+  while (!mTimers.empty()) {
+    auto now = Clock::now();
+    auto it = mTimers.begin();
+
+    if (it->first.first > now)
+      break;
+
+    uint32_t lateness = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - it->first.first).count();
+    if (lateness > mMaxLatenessUs)
+      mMaxLatenessUs = lateness;
+
+    Callback callback = std::move(it->second);
+    mTimers.erase(it);
+    mFired++;
+    callback();
+  }
+
+  arm();
+}
+
+void TimerQueue::drain() {
+  while (!mTimers.empty()) {
+    std::this_thread::sleep_until(mTimers.begin()->first.first);
+    run();
+  }
+}
+
+void TimerQueue::arm() {
+  struct itimerspec spec = {};
+
+  if (!mTimers.empty()) {
+    auto delay = mTimers.begin()->first.first - Clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+
+    // A zero it_value disarms the timer, so fire already expired ones asap
+    if (ns <= 0)
+      ns = 1;
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+  }
+
+  if (timerfd_settime(mTimerFd.get(), 0, &spec, nullptr) == -1)
+    ALOGE("timerfd_settime failed; errno=%d", errno);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
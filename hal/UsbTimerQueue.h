@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBTIMERQUEUE_H
+#define ANDROID_HARDWARE_USB_QTI_USBTIMERQUEUE_H
+
+#include <android-base/unique_fd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <utility>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::unique_fd;
+
+/*
+ * One-shot timers backed by a single timerfd, meant to be polled from an
+ * epoll loop. Replaces sleeping inline on the event thread: work that has
+ * to happen "a bit later" is scheduled as a continuation instead.
+ *
+ * Not thread safe; schedule(), cancel() and run() must be called from the
+ * thread polling fd().
+ */
+class TimerQueue {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::function<void()> Callback;
+
+  TimerQueue();
+
+  int fd() const { return mTimerFd.get(); }
+
+  // Returns an id for cancel(), never 0
+  uint64_t schedule(std::chrono::milliseconds delay, Callback callback);
+  // No-op if the timer already fired or was cancelled
+  void cancel(uint64_t id);
+  void clear();
+
+  // Call when fd() is readable; runs every expired timer
+  void run();
+  // Run every pending timer at its deadline, sleeping in between, until
+  // none is left; for a poller about to stop
+  void drain();
+
+  // Largest delay between a timer's deadline and its callback running
+  uint32_t maxLatenessUs() const { return mMaxLatenessUs; }
+  uint64_t fired() const { return mFired; }
+
+ private:
+  void arm();
+
+  unique_fd mTimerFd;
+  // Pending timers ordered by deadline; the id breaks ties
+  std::map<std::pair<Clock::time_point, uint64_t>, Callback> mTimers;
+  uint64_t mNextId;
+
+  std::atomic<uint32_t> mMaxLatenessUs;
+  std::atomic<uint64_t> mFired;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBTIMERQUEUE_H
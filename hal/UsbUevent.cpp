@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG "android.hardware.usb-service.qti"
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <chrono>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <utils/Log.h>
+
+#include "UsbUevent.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using std::string_view;
+
+static constexpr string_view kSocPrefix = "/devices/platform/soc/";
+static constexpr string_view kXhciAnchor = "dwc3/xhci-hcd.";
+
+static inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+/*
+ * Matches "(?:/[\d\.-]+)*", i.e. the hub port chain and configuration
+ * suffix of a USB device directory such as /1.2/1-1.2.4
+ */
+static bool isDeviceTail(string_view tail) {
+  while (!tail.empty()) {
+    if (tail[0] != '/')
+      return false;
+
+    size_t len = 1;
+    while (len < tail.size() && tail[len] != '/') {
+      char c = tail[len];
+      if (!isDigit(c) && c != '.' && c != '-')
+        return false;
+      len++;
+    }
+
+    if (len == 1)
+      return false;
+
+    tail.remove_prefix(len);
+  }
+
+  return true;
+}
+
+/*
+ * Matches "/devices/platform/soc/.*dwc3/xhci-hcd\.\d\.auto/usb\d/\d-\d(?:/[\d\.-]+)*"
+ * and optionally returns the root hub directory (".../usbN").
+ */
+static bool parseXhciDevicePath(string_view path, string_view *busPath) {
+  if (path.substr(0, kSocPrefix.size()) != kSocPrefix)
+    return false;
+
+  for (size_t pos = path.find(kXhciAnchor, kSocPrefix.size()); pos != string_view::npos;
+       pos = path.find(kXhciAnchor, pos + 1)) {
+    // xhci-hcd.N.auto/usbN/N-N
+    string_view rest = path.substr(pos + kXhciAnchor.size());
+
+    if (rest.size() < 15 || !isDigit(rest[0]) || rest.substr(1, 6) != ".auto/")
+      continue;
+    rest.remove_prefix(7);
+
+    if (rest.substr(0, 3) != "usb" || !isDigit(rest[3]) || rest[4] != '/')
+      continue;
+    size_t busEnd = path.size() - rest.size() + 4;
+    rest.remove_prefix(5);
+
+    if (rest.size() < 3 || !isDigit(rest[0]) || rest[1] != '-' || !isDigit(rest[2]))
+      continue;
+    rest.remove_prefix(3);
+
+    if (!isDeviceTail(rest))
+      continue;
+
+    if (busPath)
+      *busPath = path.substr(0, busEnd);
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * Matches "<device path>/([^/]*:[^/]*)" and splits it into the device
+ * directory and the interface name.
+ */
+static bool parseXhciInterfacePath(string_view path, string_view *devicePath,
+                                   string_view *interface) {
+  size_t slash = path.rfind('/');
+
+  if (slash == string_view::npos)
+    return false;
+
+  string_view intf = path.substr(slash + 1);
+  if (intf.find(':') == string_view::npos)
+    return false;
+
+  string_view dev = path.substr(0, slash);
+  if (!parseXhciDevicePath(dev, nullptr))
+    return false;
+
+  *devicePath = dev;
+  *interface = intf;
+  return true;
+}
+
+/*
+ * Matches "/devices/platform/soc/.*\/<gadget>/udc/<gadget>"
+ */
+static bool isUdcPath(string_view path, string_view gadgetName) {
+  if (gadgetName.empty() || path.substr(0, kSocPrefix.size()) != kSocPrefix)
+    return false;
+
+  path.remove_prefix(kSocPrefix.size());
+
+  // "/<gadget>/udc/<gadget>"
+  size_t suffixLen = 2 * gadgetName.size() + 6;
+  if (path.size() < suffixLen)
+    return false;
+
+  string_view suffix = path.substr(path.size() - suffixLen);
+  return suffix[0] == '/' &&
+         suffix.substr(1, gadgetName.size()) == gadgetName &&
+         suffix.substr(1 + gadgetName.size(), 5) == "/udc/" &&
+         suffix.substr(6 + gadgetName.size()) == gadgetName;
+}
+
+// Matches "/devices/platform/soc/.*/udc/[^/]+"
+static bool isAnyUdcPath(string_view path) {
+  if (path.substr(0, kSocPrefix.size()) != kSocPrefix)
+    return false;
+
+  size_t udc = path.rfind("/udc/");
+  return udc != string_view::npos && path.find('/', udc + 5) == string_view::npos;
+}
+
+// bind@/unbind@ of a device on the soc bus by the msm-dwc3 glue driver
+static bool isDwc3DriverEvent(const Uevent &event) {
+  if (event.devpath.substr(0, kSocPrefix.size()) != kSocPrefix)
+    return false;
+
+  for (const char *env = event.env; *env; env += strlen(env) + 1) {
+    if (!strcmp(env, "DRIVER=msm-dwc3"))
+      return true;
+  }
+
+  return false;
+}
+
+UeventType classifyUevent(const char *msg, string_view gadgetName, Uevent *event) {
+  string_view header(msg);
+  size_t at = header.find('@');
+
+  *event = Uevent();
+  event->env = msg + header.size() + 1;
+
+  if (at == string_view::npos)
+    return event->type;
+
+  event->action = header.substr(0, at);
+  event->devpath = header.substr(at + 1);
+
+  if (header.find("typec/port") != string_view::npos) {
+    event->type = UeventType::TYPEC;
+  } else if (header.find("power_supply/usb") != string_view::npos) {
+    event->type = UeventType::PSY;
+  } else if (event->action == "add") {
+    if (parseXhciDevicePath(event->devpath, nullptr)) {
+      event->type = UeventType::XHCI_DEVICE_ADD;
+      event->devicePath = event->devpath;
+    } else if (isUdcPath(event->devpath, gadgetName)) {
+      event->type = UeventType::UDC_ADD;
+    } else if (isAnyUdcPath(event->devpath)) {
+      event->type = UeventType::CONTROLLER_CHANGE;
+    }
+  } else if (event->action == "remove") {
+    if (isUdcPath(event->devpath, gadgetName)) {
+      event->type = UeventType::UDC_REMOVE;
+    } else if (parseXhciDevicePath(event->devpath, &event->busPath)) {
+      event->type = UeventType::XHCI_DEVICE_REMOVE;
+      event->devicePath = event->devpath;
+    } else if (isAnyUdcPath(event->devpath)) {
+      event->type = UeventType::CONTROLLER_CHANGE;
+    }
+  } else if (event->action == "bind") {
+    if (parseXhciInterfacePath(event->devpath, &event->devicePath, &event->interface))
+      event->type = UeventType::XHCI_INTERFACE_BIND;
+    else if (isDwc3DriverEvent(*event))
+      event->type = UeventType::CONTROLLER_CHANGE;
+  } else if (event->action == "unbind") {
+    if (isDwc3DriverEvent(*event))
+      event->type = UeventType::CONTROLLER_CHANGE;
+  } else if (event->action == "change") {
+    if (parseXhciInterfacePath(event->devpath, &event->devicePath, &event->interface))
+      event->type = UeventType::XHCI_INTERFACE_CHANGE;
+  }
+
+  return event->type;
+}
+
+const char *ueventTypeToString(UeventType type) {
+  switch (type) {
+    case UeventType::TYPEC:
+      return "typec";
+    case UeventType::PSY:
+      return "psy";
+    case UeventType::XHCI_DEVICE_ADD:
+      return "xhci_add";
+    case UeventType::XHCI_DEVICE_REMOVE:
+      return "xhci_remove";
+    case UeventType::XHCI_INTERFACE_BIND:
+      return "xhci_bind";
+    case UeventType::XHCI_INTERFACE_CHANGE:
+      return "xhci_change";
+    case UeventType::UDC_ADD:
+      return "udc_add";
+    case UeventType::UDC_REMOVE:
+      return "udc_remove";
+    case UeventType::CONTROLLER_CHANGE:
+      return "controller";
+    default:
+      return "unknown";
+  }
+}
+
+UeventBatchReceiver::UeventBatchReceiver(bool kernelOnly) : mCount(0), mKernelOnly(kernelOnly) {
+  for (int i = 0; i < kBatchSize; i++) {
+    mIov[i].iov_base = mBuf[i];
+    mIov[i].iov_len = kMsgLen;
+  }
+}
+
+int UeventBatchReceiver::receive(int fd) {
+  int n;
+
+  mCount = 0;
+
+  // recvmmsg() updates the headers in place, so re-arm them on every call
+  for (int i = 0; i < kBatchSize; i++) {
+    struct msghdr &hdr = mHdr[i].msg_hdr;
+
+    hdr.msg_name = &mAddr[i];
+    hdr.msg_namelen = sizeof(mAddr[i]);
+    hdr.msg_iov = &mIov[i];
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = mCred[i];
+    hdr.msg_controllen = sizeof(mCred[i]);
+    hdr.msg_flags = 0;
+    mHdr[i].msg_len = 0;
+  }
+
+  do {
+    n = recvmmsg(fd, mHdr, kBatchSize, MSG_DONTWAIT, nullptr);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+  for (int i = 0; i < n; i++) {
+    struct msghdr &hdr = mHdr[i].msg_hdr;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    unsigned int len = mHdr[i].msg_len;
+
+    if (mKernelOnly) {
+      if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        // ignoring netlink message with no sender credentials
+        continue;
+      }
+
+      struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
+      if (cred->uid != 0) {
+        // ignoring netlink message from non-root user
+        continue;
+      }
+
+      if (mAddr[i].nl_groups == 0 || mAddr[i].nl_pid != 0) {
+        // ignoring non-kernel or unicast netlink message
+        continue;
+      }
+    }
+
+    if (len == 0 || len >= kMsgLen || (hdr.msg_flags & MSG_TRUNC)) {
+      /* overflow -- discard */
+      continue;
+    }
+
+    mBuf[i][len] = '\0';
+    mBuf[i][len + 1] = '\0';
+    mValid[mCount++] = i;
+  }
+
+  return n;
+}
+
+UeventReplay::~UeventReplay() {
+  if (!mFeeder.joinable())
+    return;
+
+  if (eventfd_write(mStopFd, 1))
+    ALOGE("uevent replay: stop eventfd write failed; errno=%d", errno);
+  mFeeder.join();
+}
+
+bool UeventReplay::wait(int timeoutMs, bool writable) {
+  struct pollfd fds[2] = {
+    { mStopFd.get(), POLLIN, 0 },
+    { mFd.get(), POLLOUT, 0 },
+  };
+
+  int n = TEMP_FAILURE_RETRY(poll(fds, writable ? 2 : 1, timeoutMs));
+
+  return n >= 0 && !(fds[0].revents & POLLIN);
+}
+
+void UeventReplay::feed(std::string trace, bool realtime) {
+  std::vector<std::string> lines = ::android::base::Split(trace, "\n");
+  std::string msg;
+
+  lines.push_back("");
+  for (auto &line : lines) {
+    line = ::android::base::Trim(line);
+
+    if (line.empty()) {
+      if (msg.empty())
+        continue;
+
+      if (msg.size() >= UeventBatchReceiver::kMsgLen) {
+        ALOGE("uevent replay: dropping oversized uevent");
+        msg.clear();
+        continue;
+      }
+
+      // Non-blocking, so that a full socket never delays a stop
+      while (TEMP_FAILURE_RETRY(send(mFd.get(), msg.data(), msg.size(), MSG_DONTWAIT)) < 0) {
+        if (errno != EAGAIN) {
+          ALOGE("uevent replay: send failed; errno=%d", errno);
+          return;
+        }
+        if (!wait(-1, true))
+          return;
+      }
+      mSent++;
+      msg.clear();
+    } else if (line[0] == '#') {
+      continue;
+    } else if (line[0] == '+' && msg.empty()) {
+      if (realtime && !wait(atoi(line.c_str() + 1), false))
+        return;
+    } else {
+      // NUL separated, as the kernel sends them
+      msg.append(line).push_back('\0');
+    }
+  }
+
+  ALOGI("uevent replay: fed %zu uevents", mSent.load());
+}
+
+::android::base::unique_fd UeventReplay::open(const std::string &path, bool realtime) {
+  int fds[2];
+  std::string trace;
+
+  if (!::android::base::ReadFileToString(path, &trace)) {
+    ALOGE("uevent replay: unable to read %s", path.c_str());
+    return {};
+  }
+
+  mStopFd.reset(eventfd(0, EFD_CLOEXEC));
+  if (mStopFd == -1) {
+    ALOGE("uevent replay: eventfd failed; errno=%d", errno);
+    return {};
+  }
+
+  if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) == -1) {
+    ALOGE("uevent replay: socketpair failed; errno=%d", errno);
+    return {};
+  }
+
+  mFd.reset(fds[1]);
+  mFeeder = std::thread(&UeventReplay::feed, this, std::move(trace), realtime);
+
+  return ::android::base::unique_fd(fds[0]);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
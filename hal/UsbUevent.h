@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_USBUEVENT_H
+#define ANDROID_HARDWARE_USB_QTI_USBUEVENT_H
+
+#include <android-base/unique_fd.h>
+#include <atomic>
+#include <linux/netlink.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+enum class UeventType {
+  UNKNOWN,
+  // /sys/class/typec/portN and its partner/cable children
+  TYPEC,
+  // /sys/class/power_supply/usb
+  PSY,
+  // add@ of a device enumerated on the dwc3 xHCI root hub
+  XHCI_DEVICE_ADD,
+  // remove@ of a device enumerated on the dwc3 xHCI root hub
+  XHCI_DEVICE_REMOVE,
+  // bind@ of an interface of a device on the dwc3 xHCI root hub
+  XHCI_INTERFACE_BIND,
+  // change@ of an interface, raised on USB bus reset
+  XHCI_INTERFACE_CHANGE,
+  // add@/remove@ of the gadget controller's UDC
+  UDC_ADD,
+  UDC_REMOVE,
+  // add@/remove@ of another controller's UDC, bind@/unbind@ of an
+  // msm-dwc3 platform device
+  CONTROLLER_CHANGE,
+};
+
+constexpr size_t kUeventTypeCount = static_cast<size_t>(UeventType::CONTROLLER_CHANGE) + 1;
+
+struct Uevent {
+  UeventType type = UeventType::UNKNOWN;
+  // "add", "remove", "bind", ... (without the '@')
+  std::string_view action;
+  // DEVPATH relative to /sys, e.g. /devices/platform/soc/...
+  std::string_view devpath;
+  // For XHCI_* events: the USB device directory (usbN/N-N[/...]) below /sys
+  std::string_view devicePath;
+  // For XHCI_INTERFACE_*: the interface directory name, e.g. 1-1:1.0
+  std::string_view interface;
+  // For XHCI_DEVICE_REMOVE: the root hub directory (.../usbN)
+  std::string_view busPath;
+  // First KEY=VALUE pair following the action@devpath header
+  const char *env = nullptr;
+};
+
+/*
+ * Classify a NUL-separated netlink uevent message in a single pass over its
+ * header. Replaces the per-message std::regex_match chain; the accepted
+ * paths are exactly the ones the former regexes matched.
+ *
+ * msg must be terminated by two NUL bytes. gadgetName is the value of
+ * vendor.usb.controller and is only used to recognise UDC events.
+ */
+UeventType classifyUevent(const char *msg, std::string_view gadgetName, Uevent *event);
+
+const char *ueventTypeToString(UeventType type);
+
+/*
+ * Drains a NETLINK_KOBJECT_UEVENT socket with recvmmsg() into a reusable
+ * ring of message buffers. Messages not sent by the kernel (non-zero
+ * sender pid or uid, unicast) and truncated messages are dropped, as
+ * uevent_kernel_multicast_recv() does.
+ *
+ * A receiver created with kernelOnly = false skips the sender checks, for
+ * reading from a replay socket (see UeventReplay).
+ */
+class UeventBatchReceiver {
+ public:
+  static constexpr int kBatchSize = 32;
+  static constexpr int kMsgLen = 2048;
+
+  explicit UeventBatchReceiver(bool kernelOnly = true);
+
+  // Receive up to kBatchSize queued datagrams without blocking. Returns the
+  // number of datagrams taken off the socket, 0 once it has been drained,
+  // or -1 on error. Only count() of them passed validation.
+  int receive(int fd);
+  int count() const { return mCount; }
+  // Valid until the next receive(); terminated by two NUL bytes.
+  const char *message(int i) const { return mBuf[mValid[i]]; }
+
+ private:
+  char mBuf[kBatchSize][kMsgLen + 2];
+  char mCred[kBatchSize][CMSG_SPACE(sizeof(struct ucred))];
+  struct sockaddr_nl mAddr[kBatchSize];
+  struct iovec mIov[kBatchSize];
+  struct mmsghdr mHdr[kBatchSize];
+  int mValid[kBatchSize];
+  int mCount;
+  bool mKernelOnly;
+};
+
+/*
+ * Replays a recorded uevent trace in place of the kernel netlink socket.
+ * open() returns the read end of a datagram socketpair that a feeder
+ * thread writes the trace into, or an invalid fd on error. The feeder
+ * keeps the write end open once the trace is consumed, so that the reader
+ * never sees a hangup, and is stopped and joined on destruction.
+ *
+ * The trace is text: each uevent is an "action@devpath" line followed by
+ * its KEY=VALUE lines and ended by a blank line. A "+<ms>" line delays the
+ * next uevent by that many milliseconds, unless realtime is false in which
+ * case the trace is fed as fast as it is consumed. Lines starting with '#'
+ * are ignored.
+ */
+class UeventReplay {
+ public:
+  UeventReplay() = default;
+  ~UeventReplay();
+
+  ::android::base::unique_fd open(const std::string &path, bool realtime);
+  // Number of uevents sent so far
+  size_t sent() const { return mSent; }
+
+ private:
+  void feed(std::string trace, bool realtime);
+  // Wait up to timeoutMs (-1: forever) for the write end to take another
+  // uevent if writable is set. Returns false once stopped.
+  bool wait(int timeoutMs, bool writable);
+
+  ::android::base::unique_fd mFd;
+  ::android::base::unique_fd mStopFd;
+  std::thread mFeeder;
+  std::atomic<size_t> mSent{0};
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_USBUEVENT_H
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * Port status and host mode costs against fake trees of growing size.
+ *
+ * The services need the AIDL NDK backend and binder, neither of which
+ * builds for the host, so these replay the sysfs access of
+ * Usb::resyncPortState() and of the autosuspend scan through fsPath()
+ * and SysfsAttr rather than calling into Usb.
+ */
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+#include <dirent.h>
+#include <filesystem>
+#include <limits.h>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UsbFakeTree.h"
+#include "UsbSysfs.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace {
+
+using ::android::base::ReadFileToString;
+using ::android::base::WriteStringToFile;
+
+/*
+ * fsPath() reads USB_HAL_FS_ROOT once per process, so every benchmark here
+ * shares one root and rebuilds its tree in it.
+ */
+bool useTree(int ports, int hubs, int devices) {
+  static TemporaryDir dir;
+  static bool exported = setenv("USB_HAL_FS_ROOT", dir.path, 1) == 0;
+
+  if (!exported)
+    return false;
+
+  for (auto &entry : std::filesystem::directory_iterator(dir.path))
+    std::filesystem::remove_all(entry.path());
+
+  return buildFakeTree(dir.path, ports, hubs, devices) == 0;
+}
+
+struct PortAttrs {
+  explicit PortAttrs(const std::string &portName)
+      : powerRole(fsPath("/sys/class/typec/") + portName + "/power_role"),
+        dataRole(fsPath("/sys/class/typec/") + portName + "/data_role"),
+        accessoryMode(fsPath("/sys/class/typec/") + portName + "-partner/accessory_mode"),
+        supportsPd(fsPath("/sys/class/typec/") + portName +
+                   "-partner/supports_usb_power_delivery") {}
+
+  SysfsAttr powerRole, dataRole, accessoryMode, supportsPd;
+};
+
+// What resyncPortState() reads with every port's partner attached
+void BM_PortResync(benchmark::State &state) {
+  if (!useTree(state.range(0), 1, 4)) {
+    state.SkipWithError("unable to build the fake tree");
+    return;
+  }
+
+  std::map<std::string, PortAttrs> portAttrs;
+  SysfsStats &stats = SysfsAttr::stats();
+  uint64_t opens = stats.opens, reads = stats.reads;
+  char buf[64];
+
+  for (auto _ : state) {
+    std::map<std::string, bool> names;
+    DIR *dp = opendir(fsPath("/sys/class/typec/").c_str());
+    struct dirent *ep;
+
+    while (dp && (ep = readdir(dp))) {
+      if (ep->d_type != DT_LNK)
+        continue;
+
+      const char *partner = strstr(ep->d_name, "-partner");
+      if (partner)
+        names[std::string(ep->d_name, partner - ep->d_name)] = true;
+      else
+        names.try_emplace(ep->d_name, false);
+    }
+    if (dp)
+      closedir(dp);
+
+    for (auto &[portName, connected] : names) {
+      PortAttrs &attrs = portAttrs.try_emplace(portName, portName).first->second;
+
+      if (!connected)
+        continue;
+      for (SysfsAttr *attr :
+           { &attrs.accessoryMode, &attrs.supportsPd, &attrs.powerRole, &attrs.dataRole })
+        benchmark::DoNotOptimize(attr->read(buf, sizeof(buf)));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+
+  // The first resync's opens are averaged in
+  state.counters["opens"] =
+      benchmark::Counter(stats.opens - opens, benchmark::Counter::kAvgIterations);
+  state.counters["reads"] =
+      benchmark::Counter(stats.reads - reads, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_PortResync)->RangeMultiplier(4)->Range(1, 64);
+
+// What startAutosuspendScan() and its slices do for the devices present at
+// worker start, with a hub for every 8 devices
+void BM_AutosuspendScan(benchmark::State &state) {
+  int devices = state.range(0);
+
+  if (!useTree(1, (devices + 7) / 8, devices)) {
+    state.SkipWithError("unable to build the fake tree");
+    return;
+  }
+
+  std::string usbdevices = fsPath("/sys/bus/usb/devices/");
+  char buf[PATH_MAX];
+
+  for (auto _ : state) {
+    DIR *dp = opendir(usbdevices.c_str());
+    struct dirent *deviceDir;
+
+    while (dp && (deviceDir = readdir(dp))) {
+      if (deviceDir->d_type != DT_LNK || strchr(deviceDir->d_name, ':'))
+        continue;
+      if (!realpath((usbdevices + deviceDir->d_name).c_str(), buf))
+        continue;
+
+      DIR *ip = opendir(buf);
+      struct dirent *intfDir;
+      std::string device(buf);
+
+      while (ip && (intfDir = readdir(ip))) {
+        std::string interfaceClass;
+
+        if (intfDir->d_type != DT_DIR || !strchr(intfDir->d_name, ':'))
+          continue;
+        if (!ReadFileToString(device + "/" + intfDir->d_name + "/bInterfaceClass",
+                              &interfaceClass) || interfaceClass.empty())
+          continue;
+
+        // audio and hubs
+        int cls = std::stoi(interfaceClass, 0, 16);
+        if ((cls == 0x01 || cls == 0x09) && WriteStringToFile("auto", device + "/power/control") &&
+            WriteStringToFile("enabled", device + "/power/wakeup"))
+          break;
+      }
+      if (ip)
+        closedir(ip);
+    }
+    if (dp)
+      closedir(dp);
+  }
+  state.SetItemsProcessed(state.iterations() * devices);
+}
+BENCHMARK(BM_AutosuspendScan)->RangeMultiplier(4)->Range(4, 256);
+
+}  // namespace
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * Refreshing the Type-C port attributes behind a PortStatus: SysfsAttr
+ * against the ReadFileToString() per attribute it replaced. The ports are
+ * plain files in a temporary directory, so opens are cheaper than kernfs
+ * lookups on a device and the gap is a lower bound.
+ */
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "UsbSysfs.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace {
+
+using ::android::base::ReadFileToString;
+using ::android::base::StringPrintf;
+using ::android::base::WriteStringToFile;
+
+// Creates <ports> ports with a partner attached and returns the paths of
+// the attributes refreshPort() reads for them
+std::vector<std::string> makePorts(const char *dir, int ports) {
+  std::vector<std::string> paths;
+
+  for (int i = 0; i < ports; i++) {
+    std::string port = StringPrintf("%s/port%d", dir, i);
+    std::string partner = StringPrintf("%s/port%d-partner", port.c_str(), i);
+
+    mkdir(port.c_str(), 0755);
+    mkdir(partner.c_str(), 0755);
+
+    for (auto &[path, value] : {
+             std::pair{ port + "/power_role", "[source] sink\n" },
+             std::pair{ port + "/data_role", "[host] device\n" },
+             std::pair{ partner + "/accessory_mode", "none\n" },
+             std::pair{ partner + "/supports_usb_power_delivery", "no\n" },
+         }) {
+      WriteStringToFile(value, path);
+      paths.push_back(path);
+    }
+  }
+
+  return paths;
+}
+
+void BM_PortRefreshReadFile(benchmark::State &state) {
+  TemporaryDir dir;
+  std::vector<std::string> paths = makePorts(dir.path, state.range(0));
+  std::string value;
+
+  for (auto _ : state) {
+    for (auto &path : paths)
+      benchmark::DoNotOptimize(ReadFileToString(path, &value));
+  }
+  state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(BM_PortRefreshReadFile)->Arg(1)->Arg(2)->Arg(4);
+
+void BM_PortRefreshSysfsAttr(benchmark::State &state) {
+  TemporaryDir dir;
+  std::vector<std::string> paths = makePorts(dir.path, state.range(0));
+  std::vector<SysfsAttr> attrs(paths.begin(), paths.end());
+  SysfsStats &stats = SysfsAttr::stats();
+  uint64_t opens = stats.opens, reads = stats.reads;
+  char buf[64];
+
+  for (auto _ : state) {
+    for (auto &attr : attrs)
+      benchmark::DoNotOptimize(attr.read(buf, sizeof(buf)));
+  }
+  state.SetItemsProcessed(state.iterations() * attrs.size());
+
+  // Syscalls per refresh of all ports, the first one's opens included
+  state.counters["opens"] =
+      benchmark::Counter(stats.opens - opens, benchmark::Counter::kAvgIterations);
+  state.counters["reads"] =
+      benchmark::Counter(stats.reads - reads, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_PortRefreshSysfsAttr)->Arg(1)->Arg(2)->Arg(4);
+
+}  // namespace
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * classifyUevent() against the std::regex_match chain uevent_event() ran
+ * before it, over the messages of UeventCorpus.h.
+ */
+
+#include <benchmark/benchmark.h>
+#include <regex>
+#include <string.h>
+
+#include "UeventCorpus.h"
+#include "UsbUevent.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace {
+
+const char *const kGadgetName = "a600000.dwc3";
+
+class RegexClassifier {
+ public:
+  RegexClassifier(const std::string &gadgetName)
+      : mAdd("add@(/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/usb\\d/\\d-\\d(?:/[\\d\\.-]+)*)"),
+        mRemove("remove@((/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/usb\\d)/\\d-\\d(?:/[\\d\\.-]+)*)"),
+        mBind("bind@(/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/usb\\d/\\d-\\d(?:/[\\d\\.-]+)*)/([^/]*:[^/]*)"),
+        mBusReset("change@(/devices/platform/soc/.*dwc3/xhci-hcd\\.\\d\\.auto/usb\\d/\\d-\\d(?:/[\\d\\.-]+)*)/([^/]*:[^/]*)"),
+        mUdc("(add|remove)@/devices/platform/soc/.*/" + gadgetName + "/udc/" + gadgetName) {}
+
+  // The order and the checks of the former uevent_event(), wakeup not ignored
+  UeventType classify(const char *msg) const {
+    std::cmatch match;
+
+    if (strstr(msg, "typec/port"))
+      return UeventType::TYPEC;
+    if (strstr(msg, "power_supply/usb"))
+      return UeventType::PSY;
+    if (std::regex_match(msg, match, mAdd))
+      return UeventType::XHCI_DEVICE_ADD;
+    if (std::regex_match(msg, match, mBind))
+      return UeventType::XHCI_INTERFACE_BIND;
+    if (std::regex_match(msg, match, mUdc))
+      return match[1] == "add" ? UeventType::UDC_ADD : UeventType::UDC_REMOVE;
+    if (std::regex_match(msg, match, mBusReset))
+      return UeventType::XHCI_INTERFACE_CHANGE;
+    if (std::regex_match(msg, match, mRemove))
+      return UeventType::XHCI_DEVICE_REMOVE;
+    return UeventType::UNKNOWN;
+  }
+
+ private:
+  std::regex mAdd, mRemove, mBind, mBusReset, mUdc;
+};
+
+// CONTROLLER_CHANGE is new with classifyUevent(); the regexes ignored those
+UeventType withoutControllerChange(UeventType type) {
+  return type == UeventType::CONTROLLER_CHANGE ? UeventType::UNKNOWN : type;
+}
+
+void BM_ClassifyUevent(benchmark::State &state) {
+  std::vector<std::string> messages = ueventMessages();
+  RegexClassifier regex(kGadgetName);
+  Uevent event;
+
+  for (auto &msg : messages) {
+    if (withoutControllerChange(classifyUevent(msg.c_str(), kGadgetName, &event)) !=
+        regex.classify(msg.c_str())) {
+      state.SkipWithError(("classification differs from the regexes: " + msg).c_str());
+      return;
+    }
+  }
+
+  for (auto _ : state) {
+    for (auto &msg : messages)
+      benchmark::DoNotOptimize(classifyUevent(msg.c_str(), kGadgetName, &event));
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK(BM_ClassifyUevent);
+
+void BM_RegexUevent(benchmark::State &state) {
+  std::vector<std::string> messages = ueventMessages();
+  RegexClassifier regex(kGadgetName);
+
+  for (auto _ : state) {
+    for (auto &msg : messages)
+      benchmark::DoNotOptimize(regex.classify(msg.c_str()));
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK(BM_RegexUevent);
+
+}  // namespace
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
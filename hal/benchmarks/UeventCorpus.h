@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef ANDROID_HARDWARE_USB_QTI_UEVENTCORPUS_H
+#define ANDROID_HARDWARE_USB_QTI_UEVENTCORPUS_H
+
+#include <algorithm>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <string>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * A cable flip into host mode followed by a hub with three devices being
+ * enumerated, a bus reset and one device leaving, interleaved with the
+ * charger and unrelated uevents a device sees meanwhile.
+ *
+ * All traces are in the UeventReplay trace format.
+ */
+static const char kCableFlipTrace[] = R"(
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+SUBSYSTEM=typec
+DEVTYPE=typec_partner
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=0
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/udc/a600000.dwc3
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/udc/a600000.dwc3
+SUBSYSTEM=udc
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto
+SUBSYSTEM=platform
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-0:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-0:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-0:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-0:1.0
+SUBSYSTEM=usb
+DRIVER=hub
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=5e3/610/6063
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+SUBSYSTEM=usb
+DRIVER=hub
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=46d/c52b/1211
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0/0003:046D:C52B.0001
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0/0003:046D:C52B.0001
+SUBSYSTEM=hid
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+SUBSYSTEM=usb
+DRIVER=usbhid
+
+add@/devices/virtual/input/input7
+DEVPATH=/devices/virtual/input/input7
+SUBSYSTEM=input
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=d8c/14/100
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2/1-1.2:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2/1-1.2:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2/1-1.2:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2/1-1.2:1.0
+SUBSYSTEM=usb
+DRIVER=snd-usb-audio
+
+add@/devices/virtual/sound/card1
+DEVPATH=/devices/virtual/sound/card1
+SUBSYSTEM=sound
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=781/5581/100
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+SUBSYSTEM=usb
+DRIVER=usb-storage
+
+add@/devices/virtual/bdi/8:0
+DEVPATH=/devices/virtual/bdi/8:0
+SUBSYSTEM=bdi
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=0
+
+change@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2/1-1.2:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.2/1-1.2:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+unbind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+SUBSYSTEM=usb
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1/1-1.1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+change@/devices/virtual/thermal/thermal_zone12
+DEVPATH=/devices/virtual/thermal/thermal_zone12
+SUBSYSTEM=thermal
+)";
+
+// A DisplayPort dock with a USB2 and a SuperSpeed hub, ethernet and
+// audio being plugged in, then unplugged
+static const char kDockTrace[] = R"(
+# plug
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+SUBSYSTEM=typec
+DEVTYPE=typec_partner
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/port0-partner.0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/port0-partner.0
+SUBSYSTEM=typec
+DEVTYPE=typec_alternate_mode
+SVID=ff01
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=1
+POWER_SUPPLY_USB_TYPE=PD
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/udc/a600000.dwc3
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/udc/a600000.dwc3
+SUBSYSTEM=udc
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
++20
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=bda/5411/101
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+SUBSYSTEM=usb
+DRIVER=hub
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=bda/411/101
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+SUBSYSTEM=usb
+DRIVER=hub
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=bda/8153/3100
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+add@/devices/virtual/net/eth0
+DEVPATH=/devices/virtual/net/eth0
+SUBSYSTEM=net
+INTERFACE=eth0
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+SUBSYSTEM=usb
+DRIVER=r8152
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+PRODUCT=bda/4014/1
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+add@/devices/virtual/sound/card1
+DEVPATH=/devices/virtual/sound/card1
+SUBSYSTEM=sound
+
+bind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+SUBSYSTEM=usb
+DRIVER=snd-usb-audio
+
+change@/devices/virtual/drm/card0
+DEVPATH=/devices/virtual/drm/card0
+SUBSYSTEM=drm
+HOTPLUG=1
+
++3000
+# unplug
+remove@/devices/virtual/net/eth0
+DEVPATH=/devices/virtual/net/eth0
+SUBSYSTEM=net
+
+unbind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+SUBSYSTEM=usb
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3/1-1.3:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1.3
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+unbind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+SUBSYSTEM=usb
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1/2-1.1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1.1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+unbind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+SUBSYSTEM=usb
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1/2-1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb2/2-1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+unbind@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+SUBSYSTEM=usb
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1/1-1:1.0
+SUBSYSTEM=usb
+DEVTYPE=usb_interface
+
+remove@/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto/usb1/1-1
+SUBSYSTEM=usb
+DEVTYPE=usb_device
+
+remove@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/port0-partner.0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/port0-partner.0
+SUBSYSTEM=typec
+
+remove@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=0
+
+add@/devices/platform/soc/a600000.ssusb/a600000.dwc3/udc/a600000.dwc3
+DEVPATH=/devices/platform/soc/a600000.ssusb/a600000.dwc3/udc/a600000.dwc3
+SUBSYSTEM=udc
+
+)";
+
+// A PD charger negotiating 5 V then 9 V, followed by a power role swap
+// and detach
+static const char kPdTrace[] = R"(
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+SUBSYSTEM=typec
+DEVTYPE=typec_partner
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=1
+POWER_SUPPLY_USB_TYPE=C
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1
+SUBSYSTEM=usb_power_delivery
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/1:fixed_supply
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/1:fixed_supply
+SUBSYSTEM=usb_power_delivery
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/2:fixed_supply
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/2:fixed_supply
+SUBSYSTEM=usb_power_delivery
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/3:fixed_supply
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/3:fixed_supply
+SUBSYSTEM=usb_power_delivery
+
+add@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/4:fixed_supply
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner/pd1/source-capabilities/4:fixed_supply
+SUBSYSTEM=usb_power_delivery
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0/port0-partner
+SUBSYSTEM=typec
+DEVTYPE=typec_partner
+
++100
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=1
+POWER_SUPPLY_USB_TYPE=PD
+POWER_SUPPLY_VOLTAGE_NOW=5000000
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+POWER_SUPPLY_STATUS=Charging
+
++100
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=1
+POWER_SUPPLY_USB_TYPE=PD
+POWER_SUPPLY_VOLTAGE_NOW=9000000
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+POWER_SUPPLY_STATUS=Charging
+
++500
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_ONLINE=0
+
+)";
+
+// Moisture detected and cleared twice with the port otherwise idle
+static const char kMoistureTrace[] = R"(
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_MOISTURE_DETECTED=1
+POWER_SUPPLY_ONLINE=0
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+POWER_SUPPLY_HEALTH=Good
+
++2000
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_MOISTURE_DETECTED=0
+POWER_SUPPLY_ONLINE=0
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+POWER_SUPPLY_HEALTH=Good
+
++2000
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_MOISTURE_DETECTED=1
+POWER_SUPPLY_ONLINE=0
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+POWER_SUPPLY_HEALTH=Good
+
++2000
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/usb
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=usb
+POWER_SUPPLY_MOISTURE_DETECTED=0
+POWER_SUPPLY_ONLINE=0
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,ucsi/typec/port0
+SUBSYSTEM=typec
+
+change@/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/soc:qcom,pmic_glink:qcom,battery_charger/power_supply/battery
+SUBSYSTEM=power_supply
+POWER_SUPPLY_NAME=battery
+POWER_SUPPLY_HEALTH=Good
+
++2000
+)";
+
+/*
+ * A 4-port hub with a 4-port hub on each port and a two-interface HID
+ * device on every downstream port enumerating at once, then the whole tree
+ * detaching: 5 hubs and 16 devices.
+ */
+static inline std::string hubStormTrace() {
+  using ::android::base::StringPrintf;
+
+  const std::string xhci = "/devices/platform/soc/a600000.ssusb/a600000.dwc3/xhci-hcd.0.auto";
+  std::vector<std::string> devices = { "usb1/1-1" };
+  std::string trace;
+
+  for (int hub = 1; hub <= 4; hub++) {
+    devices.push_back(StringPrintf("usb1/1-1/1-1.%d", hub));
+    for (int port = 1; port <= 4; port++)
+      devices.push_back(StringPrintf("usb1/1-1/1-1.%d/1-1.%d.%d", hub, hub, port));
+  }
+
+  auto event = [&](const char *action, const std::string &path, const std::string &env) {
+    trace += StringPrintf("%s@%s/%s\nDEVPATH=%s/%s\nSUBSYSTEM=usb\n%s\n", action, xhci.c_str(),
+                          path.c_str(), xhci.c_str(), path.c_str(), env.c_str());
+  };
+
+  for (auto &device : devices) {
+    std::string name = device.substr(device.rfind('/') + 1);
+    bool hub = std::count(name.begin(), name.end(), '.') < 2;
+    int interfaces = hub ? 1 : 2;
+
+    event("add", device, "DEVTYPE=usb_device\n");
+    for (int i = 0; i < interfaces; i++) {
+      std::string intf = StringPrintf("%s/%s:1.%d", device.c_str(), name.c_str(), i);
+
+      event("add", intf, "DEVTYPE=usb_interface\n");
+      event("bind", intf, hub ? "DRIVER=hub\n" : "DRIVER=usbhid\n");
+    }
+  }
+
+  trace += "+1000\n";
+  for (auto it = devices.rbegin(); it != devices.rend(); ++it) {
+    std::string name = it->substr(it->rfind('/') + 1);
+    int interfaces = std::count(name.begin(), name.end(), '.') < 2 ? 1 : 2;
+
+    for (int i = 0; i < interfaces; i++) {
+      std::string intf = StringPrintf("%s/%s:1.%d", it->c_str(), name.c_str(), i);
+
+      event("unbind", intf, "");
+      event("remove", intf, "DEVTYPE=usb_interface\n");
+    }
+    event("remove", *it, "DEVTYPE=usb_device\n");
+  }
+
+  return trace;
+}
+
+struct UeventTrace {
+  const char *name;
+  std::string text;
+};
+
+static inline std::vector<UeventTrace> ueventTraces() {
+  return {
+    { "cable_flip", kCableFlipTrace },
+    { "dock", kDockTrace },
+    { "hub_storm", hubStormTrace() },
+    { "pd", kPdTrace },
+    { "moisture", kMoistureTrace },
+  };
+}
+
+// trace as the NUL separated messages the kernel would send, each
+// terminated by two NUL bytes
+static inline std::vector<std::string> ueventMessages(const std::string &trace) {
+  std::vector<std::string> messages;
+  std::string msg;
+
+  for (auto &line : ::android::base::Split(trace + "\n", "\n")) {
+    if (!line.empty() && (line[0] == '#' || (line[0] == '+' && msg.empty())))
+      continue;
+
+    if (!line.empty()) {
+      msg.append(line).push_back('\0');
+    } else if (!msg.empty()) {
+      msg.push_back('\0');
+      messages.push_back(std::move(msg));
+      msg.clear();
+    }
+  }
+
+  return messages;
+}
+
+// The messages of all traces
+static inline std::vector<std::string> ueventMessages() {
+  std::vector<std::string> messages;
+
+  for (auto &trace : ueventTraces()) {
+    for (auto &msg : ueventMessages(trace.text))
+      messages.push_back(std::move(msg));
+  }
+
+  return messages;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+#endif  // ANDROID_HARDWARE_USB_QTI_UEVENTCORPUS_H
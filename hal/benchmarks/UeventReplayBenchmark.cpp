@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/*
+ * The uevent path of the worker without the handlers: UeventReplay feeds
+ * each trace of UeventCorpus.h through its socketpair at full speed,
+ * UeventBatchReceiver drains it and classifyUevent() sorts the messages.
+ * Fails if a uevent is lost or classified differently than when read
+ * straight from the trace.
+ *
+ * uevent_event(), the handlers it dispatches to and the IUsbCallback
+ * notifications need the AIDL service, which does not build for the host,
+ * so there is no fake sysfs tree behind the replay and the counts
+ * reported are per uevent type, not per callback.
+ */
+
+#include <android-base/file.h>
+#include <array>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <poll.h>
+
+#include "UeventCorpus.h"
+#include "UsbStats.h"
+#include "UsbUevent.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace {
+
+const char *const kGadgetName = "a600000.dwc3";
+// Corpus copies per replay, to amortise the feeder thread start
+constexpr int kCopies = 32;
+
+void BM_UeventReplay(benchmark::State &state) {
+  UeventTrace source = ueventTraces()[state.range(0)];
+  TemporaryDir dir;
+  std::string trace, path = std::string(dir.path) + "/trace";
+  std::array<uint64_t, kUeventTypeCount> expected = {};
+  std::array<uint64_t, kUeventTypeCount> received = {};
+  std::array<LatencyHistogram, kUeventTypeCount> classifyNs;
+  UeventBatchReceiver receiver(false);
+  size_t total = 0;
+  Uevent event;
+
+  state.SetLabel(source.name);
+  for (auto &msg : ueventMessages(source.text))
+    expected[static_cast<size_t>(classifyUevent(msg.c_str(), kGadgetName, &event))] += kCopies;
+  for (auto count : expected)
+    total += count;
+  for (int i = 0; i < kCopies; i++)
+    trace += source.text;
+  if (!::android::base::WriteStringToFile(trace, path)) {
+    state.SkipWithError("unable to write the trace");
+    return;
+  }
+
+  for (auto _ : state) {
+    UeventReplay replay;
+    ::android::base::unique_fd fd = replay.open(path, false);
+    size_t count = 0;
+
+    received.fill(0);
+    while (fd != -1 && count < total) {
+      struct pollfd pfd = { fd.get(), POLLIN, 0 };
+
+      if (TEMP_FAILURE_RETRY(poll(&pfd, 1, 1000)) <= 0 || receiver.receive(fd.get()) < 0)
+        break;
+
+      for (int i = 0; i < receiver.count(); i++) {
+        auto start = std::chrono::steady_clock::now();
+        UeventType type = classifyUevent(receiver.message(i), kGadgetName, &event);
+        auto end = std::chrono::steady_clock::now();
+
+        classifyNs[static_cast<size_t>(type)].record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        received[static_cast<size_t>(type)]++;
+        count++;
+      }
+    }
+
+    if (received != expected) {
+      state.SkipWithError("replayed uevents lost or misclassified");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * total);
+
+  for (size_t type = 0; type < kUeventTypeCount; type++) {
+    if (!expected[type])
+      continue;
+
+    std::string name = ueventTypeToString(static_cast<UeventType>(type));
+    state.counters[name] = expected[type];
+    state.counters[name + "_p50_ns"] = classifyNs[type].percentile(50);
+    state.counters[name + "_p99_ns"] = classifyNs[type].percentile(99);
+  }
+}
+BENCHMARK(BM_UeventReplay)->DenseRange(0, ueventTraces().size() - 1)->UseRealTime();
+
+}  // namespace
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,9 @@
+#
+# Board configuration for the USB components. vendor_product.mk already
+# adds the sepolicy directory; including this file from BoardConfig.mk as
+# well is harmless, the directory is only listed once.
+#
+USB_SEPOLICY_DIR := vendor/qcom/opensource/usb/sepolicy
+ifeq ($(filter $(USB_SEPOLICY_DIR),$(BOARD_VENDOR_SEPOLICY_DIRS)),)
+  BOARD_VENDOR_SEPOLICY_DIRS += $(USB_SEPOLICY_DIR)
+endif
@@ -46,6 +46,15 @@ ifneq ($(TARGET_KERNEL_VERSION),$(filter $(TARGET_KERNEL_VERSION),3.18 4.4 4.9 4
   PRODUCT_PACKAGES += android.hardware.usb-service.qti
 endif
 
+# Domains of usb_gadget_provision and usb_compose, and the gadget HAL's
+# property contexts. Added here because every target includes this file;
+# init cannot exec the tools without them, which would leave every
+# sys.usb.config change on configfs targets unapplied.
+USB_SEPOLICY_DIR := vendor/qcom/opensource/usb/sepolicy
+ifeq ($(filter $(USB_SEPOLICY_DIR),$(BOARD_VENDOR_SEPOLICY_DIRS)),)
+  BOARD_VENDOR_SEPOLICY_DIRS += $(USB_SEPOLICY_DIR)
+endif
+
 USB_USES_QMAA = $(TARGET_USES_QMAA)
 ifeq ($(TARGET_USES_QMAA_OVERRIDE_USB),true)
        USB_USES_QMAA = false
@@ -56,6 +65,9 @@ ifeq ($(USB_USES_QMAA),true)
   PRODUCT_PACKAGES += init.qti.usb.qmaa.rc
 else
   PRODUCT_PACKAGES += init.qcom.usb.rc init.qcom.usb.sh
+  # exec'd by init.qcom.usb.rc in the domains from USB_SEPOLICY_DIR
+  PRODUCT_PACKAGES += usb_gadget_provision usb_compose
+  PRODUCT_PACKAGES += usb_compositions.conf usb_compositions.bin
 
   #
   # USB Gadget HAL is enabled on newer targets and takes the place
@@ -64,7 +76,6 @@ else
   ifeq ($(PRODUCT_HAS_GADGET_HAL),true)
     PRODUCT_PROPERTY_OVERRIDES += vendor.usb.use_gadget_hal=1
     PRODUCT_PACKAGES += android.hardware.usb.gadget-service.qti
-    PRODUCT_PACKAGES += usb_compositions.conf
   else
     PRODUCT_PROPERTY_OVERRIDES += vendor.usb.use_gadget_hal=0
   endif